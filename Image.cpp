@@ -1,68 +1,407 @@
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <string>
+#include <vector>
 #include "Image.h"
+#include "instrumentation.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// EFFECTS: Counts an allocation if mat has to grow to hold width by
+//          height elements.
+template <typename T>
+static void count_allocation(const Basic_matrix<T>* mat, int width, int height) {
+  if (mat->capacity < width * height){
+    INSTRUMENT_COUNT(COUNTER_ALLOCATIONS, 1);
+  }
+}
+
 // REQUIRES: img points to an Image
-//           0 < width && width <= MAX_MATRIX_WIDTH
-//           0 < height && height <= MAX_MATRIX_HEIGHT
+//           0 < width && 0 < height
 // MODIFIES: *img
-// EFFECTS:  Initializes the Image with the given width and height.
-// NOTE:     Do NOT use new or delete here.
+// EFFECTS:  Initializes the Image with the given width and height, in the
+//           IMAGE_PLANAR layout.
+//           Channel storage is reused when it is already large enough.
 void Image_init(Image* img, int width, int height) {
-  assert(0 < width && width <= MAX_MATRIX_WIDTH);
-  assert(0 < height && height <= MAX_MATRIX_HEIGHT);
+  Image_init(img, width, height, IMAGE_PLANAR);
+}
+
+// REQUIRES: img points to an Image
+//           0 < width && 0 < height
+// MODIFIES: *img
+// EFFECTS:  Initializes the Image with the given width, height and
+//           layout. Storage is reused when it is already large enough.
+void Image_init(Image* img, int width, int height, Image_layout layout) {
+  assert(0 < width && 0 < height);
+  if (layout == IMAGE_INTERLEAVED){
+    count_allocation(&img->pixels, width, height);
+  }else{
+    count_allocation(&img->red_channel, width, height);
+    count_allocation(&img->green_channel, width, height);
+    count_allocation(&img->blue_channel, width, height);
+  }
   img->width = width;
   img->height = height;
-  Matrix_init(&img->red_channel, width, height);
-  Matrix_init(&img->green_channel, width, height);
-  Matrix_init(&img->blue_channel, width, height);
+  img->layout = layout;
+  // The matrices of the other layout are emptied (keeping their storage)
+  // so that copying the Image does not copy them.
+  if (layout == IMAGE_INTERLEAVED){
+    Matrix_init(&img->pixels, width, height);
+    img->red_channel = Byte_matrix();
+    img->green_channel = Byte_matrix();
+    img->blue_channel = Byte_matrix();
+  }else{
+    Matrix_init(&img->red_channel, width, height);
+    Matrix_init(&img->green_channel, width, height);
+    Matrix_init(&img->blue_channel, width, height);
+    img->pixels = Rgb_matrix();
+  }
 }
 
 // REQUIRES: img points to an Image
-//           is contains an image in PPM format without comments
-//           (any kind of whitespace is ok)
+//           0 < width && 0 < height
+//           pixels was allocated with new Byte_rgb[n], n >= width * height,
+//           and holds the pixels row after row
 // MODIFIES: *img
+// EFFECTS:  Initializes the Image as IMAGE_INTERLEAVED on top of pixels,
+//           without copying them. The Image takes ownership of pixels.
+void Image_init_interleaved(Image* img, int width, int height,
+                            Byte_rgb* pixels) {
+  assert(0 < width && 0 < height);
+  img->width = width;
+  img->height = height;
+  img->layout = IMAGE_INTERLEAVED;
+  Matrix_adopt(&img->pixels, pixels, width, height);
+  img->red_channel = Byte_matrix();
+  img->green_channel = Byte_matrix();
+  img->blue_channel = Byte_matrix();
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  Returns the pixels of the Image interleaved, row after row, in
+//           a block the caller owns and must free with delete[]. The Image
+//           must be initialized again before it is used.
+Byte_rgb* Image_release_interleaved(Image* img) {
+  Image_set_layout(img, IMAGE_INTERLEAVED);
+  img->width = 0;
+  img->height = 0;
+  return Matrix_release(&img->pixels);
+}
+
+// REQUIRES: img points to a valid Image
+// EFFECTS:  Returns the layout of the Image.
+Image_layout Image_get_layout(const Image* img) {
+  return img->layout;
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  Converts the Image to the given layout, keeping its pixels.
+//           Does nothing if the Image already has that layout.
+void Image_set_layout(Image* img, Image_layout layout) {
+  if (Image_get_layout(img) == layout){
+    return;
+  }
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  if (layout == IMAGE_INTERLEAVED){
+    Matrix_init(&img->pixels, width, height);
+    for (int r = 0; r < height; ++r){
+      const uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+      const uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+      const uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
+      Byte_rgb* row = Matrix_at(&img->pixels, r, 0);
+      for (int c = 0; c < width; ++c){
+        row[c].r = red[c];
+        row[c].g = green[c];
+        row[c].b = blue[c];
+      }
+    }
+    img->red_channel = Byte_matrix();
+    img->green_channel = Byte_matrix();
+    img->blue_channel = Byte_matrix();
+  }else{
+    Matrix_init(&img->red_channel, width, height);
+    Matrix_init(&img->green_channel, width, height);
+    Matrix_init(&img->blue_channel, width, height);
+    for (int r = 0; r < height; ++r){
+      const Byte_rgb* row = Matrix_at(&img->pixels, r, 0);
+      uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+      uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+      uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
+      for (int c = 0; c < width; ++c){
+        red[c] = row[c].r;
+        green[c] = row[c].g;
+        blue[c] = row[c].b;
+      }
+    }
+    img->pixels = Rgb_matrix();
+  }
+  img->layout = layout;
+}
+
+// A streambuf whose get area is a fixed block of memory, such as a
+// memory-mapped file. Reading from it never copies or refills.
+class Memory_buf : public std::streambuf {
+public:
+  Memory_buf(const char* begin, size_t size) {
+    char* start = const_cast<char*>(begin);
+    setg(start, start, start + size);
+  }
+};
+
+// EFFECTS: Returns true if c is a PPM whitespace character.
+static bool is_ppm_space(int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+// REQUIRES: buf points to a valid streambuf
+// MODIFIES: *buf
+// EFFECTS:  Consumes whitespace and comments, which run from '#' to the end
+//           of the line.
+static void skip_ppm_space(std::streambuf* buf) {
+  for (int c = buf->sgetc(); c != EOF; c = buf->sgetc()){
+    if (c == '#'){
+      while (c != EOF && c != '\n'){
+        c = buf->snextc();
+      }
+    }else if (!is_ppm_space(c)){
+      return;
+    }else{
+      buf->sbumpc();
+    }
+  }
+}
+
+// REQUIRES: buf points to a valid streambuf
+// MODIFIES: *buf
+// EFFECTS:  Skips whitespace and comments, then reads a decimal integer no
+//           larger than max_value. Throws Ppm_error naming what was
+//           expected if there is none.
+static int read_ppm_int(std::streambuf* buf, int max_value, const char* what) {
+  skip_ppm_space(buf);
+  int c = buf->sgetc();
+  if (c < '0' || c > '9'){
+    throw Ppm_error(string("expected ") + what);
+  }
+  int value = 0;
+  for (; '0' <= c && c <= '9'; c = buf->snextc()){
+    value = 10 * value + (c - '0');
+    if (value > max_value){
+      throw Ppm_error(string(what) + " is too large");
+    }
+  }
+  if (c != EOF && !is_ppm_space(c) && c != '#'){
+    throw Ppm_error(string("unexpected character after ") + what);
+  }
+  return value;
+}
+
+// REQUIRES: img points to a valid Image
+//           buf is positioned just after the maximum value in the header
+//           of a plain PPM
+// MODIFIES: *img, *buf
+// EFFECTS:  Decodes the plain pixel data of the Image straight into the
+//           channels.
+static void Image_read_plain_pixels(Image* img, std::streambuf* buf) {
+  const int width = Image_width(img);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    for (int r = 0; r < Image_height(img); ++r){
+      Byte_rgb* row = Matrix_at(&img->pixels, r, 0);
+      for (int c = 0; c < width; ++c){
+        row[c].r = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+        row[c].g = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+        row[c].b = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+      }
+    }
+    return;
+  }
+  for (int r = 0; r < Image_height(img); ++r){
+    uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+    uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+    uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
+    for (int c = 0; c < width; ++c){
+      red[c] = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+      green[c] = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+      blue[c] = static_cast<uint8_t>(read_ppm_int(buf, MAX_INTENSITY, "pixel value"));
+    }
+  }
+}
+
+// REQUIRES: img points to a valid Image
+//           buf is positioned just after the maximum value in the header
+//           of a binary PPM
+// MODIFIES: *img, *buf
+// EFFECTS:  Reads the binary pixel data of the Image. An interleaved
+//           Image takes it in one bulk read; a planar one reads a row at a
+//           time and de-interleaves it into the channels.
+static void Image_read_binary_pixels(Image* img, std::streambuf* buf) {
+  // Exactly one whitespace character separates the header from the data.
+  if (!is_ppm_space(buf->sbumpc())){
+    throw Ppm_error("expected whitespace after maximum value");
+  }
+  const int width = Image_width(img);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    // Image_init leaves the rows packed, so they are one block of bytes.
+    const streamsize size = streamsize(3) * width * Image_height(img);
+    char* bytes = reinterpret_cast<char*>(Matrix_at(&img->pixels, 0, 0));
+    if (buf->sgetn(bytes, size) != size){
+      throw Ppm_error("pixel data is truncated");
+    }
+    return;
+  }
+  vector<unsigned char> row_bytes(3 * width);
+  for (int r = 0; r < Image_height(img); ++r){
+    const streamsize size = row_bytes.size();
+    if (buf->sgetn(reinterpret_cast<char*>(row_bytes.data()), size) != size){
+      throw Ppm_error("pixel data is truncated");
+    }
+    uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+    uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+    uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
+    const unsigned char* bytes = row_bytes.data();
+    for (int c = 0; c < width; ++c){
+      red[c] = bytes[3 * c];
+      green[c] = bytes[3 * c + 1];
+      blue[c] = bytes[3 * c + 2];
+    }
+  }
+}
+
+// REQUIRES: img points to an Image
+//           buf points to a valid streambuf
+// MODIFIES: *img, *buf
+// EFFECTS:  Initializes the Image, with the given layout, from the PPM
+//           image in buf. Throws Ppm_error if it is malformed.
+static void Image_read_ppm(Image* img, std::streambuf* buf,
+                           Image_layout layout) {
+  INSTRUMENT_SCOPE(STAGE_PARSE, 0);
+  // Checks that the input is a plain or binary ppm file.
+  skip_ppm_space(buf);
+  if (buf->sbumpc() != 'P'){
+    throw Ppm_error("not a PPM file");
+  }
+  const int magic = buf->sbumpc();
+  const int after_magic = buf->sgetc();
+  if ((magic != '3' && magic != '6') ||
+      !(is_ppm_space(after_magic) || after_magic == '#')){
+    throw Ppm_error("only P3 and P6 PPM files are supported");
+  }
+
+  // Intializes Image width and height. The limits keep width * height
+  // within an int.
+  const int width = read_ppm_int(buf, 1 << 15, "width");
+  const int height = read_ppm_int(buf, 1 << 15, "height");
+  if (width == 0 || height == 0){
+    throw Ppm_error("image is empty");
+  }
+
+  // Checks max pixel intensity is equal to MAX_INTENSITY.
+  if (read_ppm_int(buf, MAX_INTENSITY, "maximum value") != MAX_INTENSITY){
+    throw Ppm_error("maximum value must be 255");
+  }
+
+  Image_init(img, width, height, layout);
+  INSTRUMENT_SCOPE_PIXELS(static_cast<long long>(width) * height);
+  if (magic == '6'){
+    Image_read_binary_pixels(img, buf);
+  }else{
+    Image_read_plain_pixels(img, buf);
+  }
+}
+
+// REQUIRES: img points to an Image
+//           is contains an image in plain (P3) or binary (P6) PPM format
+// MODIFIES: *img, is
 // EFFECTS:  Initializes the Image by reading in an image in PPM format
-//           from the given input stream.
+//           from the given input stream. The format is detected from the
+//           magic number. Whitespace and '#' comments may appear anywhere
+//           the PPM spec allows them (and between P3 pixel values).
+//           Values are decoded straight from the stream's buffer into the
+//           channels, without any per-value allocation.
+//           Throws Ppm_error if the input is not a valid PPM image.
 // NOTE:     See the project spec for a discussion of PPM format.
-// NOTE:     Do NOT use new or delete here.
 void Image_init(Image* img, std::istream& is) {
-  // Checks that the input is a plain ppm file.
-  string is_valid_ppm;
-  const string plain_ppm_file = "P3";
-  is >> is_valid_ppm;
-  assert(is_valid_ppm == plain_ppm_file); 
-  
-  // Intializes Image width and height.
-  string width_str;
-  string height_str;
-  is >> width_str;
-  is >> height_str;
-  Image_init(img, stoi(width_str), stoi(height_str));
+  Image_init(img, is, IMAGE_PLANAR);
+}
 
-  // Checks max pixel intensity is equal to MAX_INTENSITY.
-  string max_value_str;
-  is >> max_value_str;
-  assert(stoi(max_value_str) == MAX_INTENSITY);
+// REQUIRES: img points to an Image
+//           is contains an image in plain (P3) or binary (P6) PPM format
+// MODIFIES: *img, is
+// EFFECTS:  Like Image_init(img, is), but the Image gets the given layout.
+void Image_init(Image* img, std::istream& is, Image_layout layout) {
+  try {
+    Image_read_ppm(img, is.rdbuf(), layout);
+  }
+  catch (Ppm_error&) {
+    is.setstate(ios::failbit);
+    throw;
+  }
+}
 
-  // Intializes a Pixel and then sets it as the color for a given row and column.
-  Pixel color;
-  for (int row = 0; row < Image_height(img); ++row){
-    for (int column = 0; column < Image_width(img); ++column){
-      string r;
-      string g;
-      string b;
-      is >> r;
-      is >> g;
-      is >> b;
-      color.r = stoi(r);
-      color.g = stoi(g);
-      color.b = stoi(b);
-      Image_set_pixel(img, row, column, color); 
+// REQUIRES: img points to an Image
+// MODIFIES: *img
+// EFFECTS:  Initializes the Image from the PPM file with the given name,
+//           like Image_init(img, is). The file is memory-mapped where the
+//           platform supports it, and read through a large buffer
+//           otherwise. Returns false if the file cannot be opened.
+//           Throws Ppm_error if it is not a valid PPM image.
+bool Image_init_from_file(Image* img, const std::string& filename) {
+  return Image_init_from_file(img, filename, IMAGE_PLANAR);
+}
+
+// REQUIRES: img points to an Image
+// MODIFIES: *img
+// EFFECTS:  Like Image_init_from_file(img, filename), but the Image gets
+//           the given layout.
+bool Image_init_from_file(Image* img, const std::string& filename,
+                          Image_layout layout) {
+#if defined(__unix__) || defined(__APPLE__)
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0){
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0){
+    const size_t size = info.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED){
+      close(fd);
+      madvise(mapping, size, MADV_SEQUENTIAL);
+      Memory_buf buf(static_cast<const char*>(mapping), size);
+      try {
+        Image_read_ppm(img, &buf, layout);
+      }
+      catch (...) {
+        munmap(mapping, size);
+        throw;
+      }
+      munmap(mapping, size);
+      return true;
     }
   }
+  close(fd);
+#endif
+  // Falls back on a plain file stream, e.g. for pipes.
+  vector<char> buffer(1 << 20);
+  ifstream fin;
+  fin.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+  fin.open(filename, ios::binary);
+  if (!fin.is_open()){
+    return false;
+  }
+  Image_init(img, fin, layout);
+  return true;
 }
 
 // REQUIRES: img points to a valid Image
@@ -78,17 +417,91 @@ void Image_init(Image* img, std::istream& is) {
 //           int is followed by a space. This means that there will be an
 //           "extra" space at the end of each line. See the project spec
 //           for an example.
+// NOTE:     The text is formatted into a buffer and written in chunks of
+//           PRINT_CHUNK_SIZE; os is flushed once, at the end.
 void Image_print(const Image* img, std::ostream& os) {
   const int height = Image_height(img);
   const int width = Image_width(img);
-  os << "P3" << endl << width << " " << height << endl << "255" << endl;
+  INSTRUMENT_SCOPE(STAGE_PRINT, static_cast<long long>(width) * height);
+  INSTRUMENT_COUNT(COUNTER_ALLOCATIONS, 1);
+  os << "P3\n" << width << " " << height << "\n255\n";
+
+  // Formats the rows into a buffer that is written out whenever it is
+  // nearly full, so the stream sees a few large writes and one flush.
+  vector<char> buffer(PRINT_CHUNK_SIZE);
+  char* const flush_point = buffer.data() + PRINT_CHUNK_SIZE - 3 * MATRIX_ELEMENT_TEXT_MAX;
+  char* out = buffer.data();
+  for (int r = 0; r < height; ++r){
+    if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+      const Byte_rgb* row = Matrix_at(&img->pixels, r, 0);
+      for (int c = 0; c < width; ++c){
+        if (out >= flush_point){
+          os.write(buffer.data(), out - buffer.data());
+          out = buffer.data();
+        }
+        out = Matrix_format_element(out, row[c].r);
+        out = Matrix_format_element(out, row[c].g);
+        out = Matrix_format_element(out, row[c].b);
+      }
+    }else{
+      const uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+      const uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+      const uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
+      for (int c = 0; c < width; ++c){
+        if (out >= flush_point){
+          os.write(buffer.data(), out - buffer.data());
+          out = buffer.data();
+        }
+        out = Matrix_format_element(out, red[c]);
+        out = Matrix_format_element(out, green[c]);
+        out = Matrix_format_element(out, blue[c]);
+      }
+    }
+    *out++ = '\n';
+  }
+  os.write(buffer.data(), out - buffer.data());
+  os.flush();
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: os
+// EFFECTS:  Writes the image to the given output stream in the given PPM
+//           format. PPM_PLAIN output is exactly what Image_print(img, os)
+//           writes. PPM_BINARY output has the header
+//             P6 [newline]
+//             WIDTH [space] HEIGHT [newline]
+//             255 [newline]
+//           followed by the red, green and blue bytes of each pixel, row
+//           by row, with no separators.
+void Image_print(const Image* img, std::ostream& os, Ppm_format format) {
+  if (format == PPM_PLAIN){
+    Image_print(img, os);
+    return;
+  }
+  const int height = Image_height(img);
+  const int width = Image_width(img);
+  INSTRUMENT_SCOPE(STAGE_PRINT, static_cast<long long>(width) * height);
+  os << "P6\n" << width << " " << height << "\n" << MAX_INTENSITY << "\n";
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    for (int r = 0; r < height; ++r){
+      os.write(reinterpret_cast<const char*>(Matrix_at(&img->pixels, r, 0)),
+               streamsize(3) * width);
+    }
+    return;
+  }
+  INSTRUMENT_COUNT(COUNTER_ALLOCATIONS, 1);
+  vector<char> row_bytes(3 * width);
   for (int r = 0; r < height; ++r){
+    const uint8_t* red = Matrix_at(&img->red_channel, r, 0);
+    const uint8_t* green = Matrix_at(&img->green_channel, r, 0);
+    const uint8_t* blue = Matrix_at(&img->blue_channel, r, 0);
     for (int c = 0; c < width; ++c){
-      Pixel color = Image_get_pixel(img, r, c);
-      os << color.r << " " << color.g << " " << color.b << " ";
+      row_bytes[3 * c] = static_cast<char>(red[c]);
+      row_bytes[3 * c + 1] = static_cast<char>(green[c]);
+      row_bytes[3 * c + 2] = static_cast<char>(blue[c]);
     }
-    os << endl;
-  }  
+    os.write(row_bytes.data(), row_bytes.size());
+  }
 }
 
 // REQUIRES: img points to a valid Image
@@ -103,6 +516,13 @@ int Image_height(const Image* img) {
   return img->height;
 }
 
+// EFFECTS: Returns true if every component of color fits in a channel.
+[[maybe_unused]] static bool Pixel_is_valid(Pixel color) {
+  return 0 <= color.r && color.r <= MAX_INTENSITY
+      && 0 <= color.g && color.g <= MAX_INTENSITY
+      && 0 <= color.b && color.b <= MAX_INTENSITY;
+}
+
 // REQUIRES: img points to a valid Image
 //           0 <= row && row < Image_height(img)
 //           0 <= column && column < Image_width(img)
@@ -111,6 +531,13 @@ Pixel Image_get_pixel(const Image* img, int row, int column) {
   assert(0 <= row && row < Image_height(img));
   assert(0 <= column && column < Image_width(img));
   Pixel color;
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    const Byte_rgb* pixel = Matrix_at(&img->pixels, row, column);
+    color.r = pixel->r;
+    color.g = pixel->g;
+    color.b = pixel->b;
+    return color;
+  }
   color.r = *Matrix_at(&img->red_channel, row, column);
   color.g = *Matrix_at(&img->green_channel, row, column);
   color.b = *Matrix_at(&img->blue_channel, row, column);
@@ -126,20 +553,35 @@ Pixel Image_get_pixel(const Image* img, int row, int column) {
 void Image_set_pixel(Image* img, int row, int column, Pixel color) {
   assert(0 <= row && row < Image_height(img));
   assert(0 <= column && column < Image_width(img));
-  *Matrix_at(&img->red_channel, row, column) = color.r;
-  *Matrix_at(&img->green_channel, row, column) = color.g;
-  *Matrix_at(&img->blue_channel, row, column) = color.b;
+  assert(Pixel_is_valid(color));
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    Byte_rgb* pixel = Matrix_at(&img->pixels, row, column);
+    pixel->r = static_cast<uint8_t>(color.r);
+    pixel->g = static_cast<uint8_t>(color.g);
+    pixel->b = static_cast<uint8_t>(color.b);
+    return;
+  }
+  *Matrix_at(&img->red_channel, row, column) = static_cast<uint8_t>(color.r);
+  *Matrix_at(&img->green_channel, row, column) = static_cast<uint8_t>(color.g);
+  *Matrix_at(&img->blue_channel, row, column) = static_cast<uint8_t>(color.b);
 }
 
 // REQUIRES: img points to a valid Image
 // MODIFIES: *img
 // EFFECTS:  Sets each pixel in the image to the given color.
 void Image_fill(Image* img, Pixel color) {
-  for (int r = 0; r < Image_height(img); ++r){
-    for (int c = 0; c < Image_width(img); ++c){
-      *Matrix_at(&img->red_channel, r, c) = color.r;
-      *Matrix_at(&img->green_channel, r, c) = color.g;
-      *Matrix_at(&img->blue_channel, r, c) = color.b;  
+  assert(Pixel_is_valid(color));
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    const Byte_rgb value = {static_cast<uint8_t>(color.r),
+                            static_cast<uint8_t>(color.g),
+                            static_cast<uint8_t>(color.b)};
+    for (int r = 0; r < Image_height(img); ++r){
+      Byte_rgb* row = Matrix_at(&img->pixels, r, 0);
+      fill(row, row + Image_width(img), value);
     }
+    return;
   }
+  Matrix_fill(&img->red_channel, color.r);
+  Matrix_fill(&img->green_channel, color.g);
+  Matrix_fill(&img->blue_channel, color.b);
 }
@@ -4,7 +4,10 @@
 /* Image.h
 */
 
+#include <cassert>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include "Matrix.h" 
 
 // Representation of an RGB Pixel used for
@@ -18,34 +21,125 @@ struct Pixel {
 
 const int MAX_INTENSITY = 255;
 
+// The two PPM encodings the Image module reads and writes: plain PPM
+// (magic number P3, decimal text) and binary PPM (magic number P6, one
+// byte per channel value).
+enum Ppm_format { PPM_PLAIN, PPM_BINARY };
+
+// Thrown when reading an image whose input is not a valid PPM image.
+class Ppm_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// The two ways an Image can store its pixels.
+// IMAGE_PLANAR keeps each color in its own Byte_matrix (red_channel,
+// green_channel and blue_channel), which suits the SIMD energy kernels.
+// IMAGE_INTERLEAVED keeps the three colors of each pixel together in one
+// Rgb_matrix (pixels), the way PPM files and decoders lay them out, so
+// reading, writing and removing pixels touches one matrix instead of
+// three.
+enum Image_layout { IMAGE_PLANAR, IMAGE_INTERLEAVED };
+
+// The color channels of an IMAGE_PLANAR Image, in the order of Pixel.
+enum Image_channel { IMAGE_RED, IMAGE_GREEN, IMAGE_BLUE };
+
 // Representation of 2D RGB image.
+// Each channel stores one byte per pixel, since intensities never exceed
+// MAX_INTENSITY. Only the matrices of the Image's layout are in use; the
+// others are empty.
 // Image objects may be copied.
 struct Image {
   int width;
   int height;
-  Matrix red_channel;
-  Matrix green_channel;
-  Matrix blue_channel;
+  Byte_matrix red_channel;    // IMAGE_PLANAR
+  Byte_matrix green_channel;  // IMAGE_PLANAR
+  Byte_matrix blue_channel;   // IMAGE_PLANAR
+  Rgb_matrix pixels;          // IMAGE_INTERLEAVED
+  Image_layout layout = IMAGE_PLANAR;
 };
 
 // REQUIRES: img points to an Image
-//           0 < width && width <= MAX_MATRIX_WIDTH
-//           0 < height && height <= MAX_MATRIX_HEIGHT
+//           0 < width && 0 < height
 // MODIFIES: *img
-// EFFECTS:  Initializes the Image with the given width and height.
-// NOTE:     Do NOT use new or delete here.
+// EFFECTS:  Initializes the Image with the given width and height, in the
+//           IMAGE_PLANAR layout.
+//           Channel storage is reused when it is already large enough.
 void Image_init(Image* img, int width, int height);
 
 // REQUIRES: img points to an Image
-//           is contains an image in PPM format without comments
-//           (any kind of whitespace is ok)
+//           0 < width && 0 < height
 // MODIFIES: *img
+// EFFECTS:  Initializes the Image with the given width, height and
+//           layout. Storage is reused when it is already large enough.
+void Image_init(Image* img, int width, int height, Image_layout layout);
+
+// REQUIRES: img points to an Image
+//           0 < width && 0 < height
+//           pixels was allocated with new Byte_rgb[n], n >= width * height,
+//           and holds the pixels row after row
+// MODIFIES: *img
+// EFFECTS:  Initializes the Image as IMAGE_INTERLEAVED on top of pixels,
+//           without copying them. The Image takes ownership of pixels.
+void Image_init_interleaved(Image* img, int width, int height,
+                            Byte_rgb* pixels);
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  Returns the pixels of the Image interleaved, row after row, in
+//           a block the caller owns and must free with delete[]. The
+//           storage of an IMAGE_INTERLEAVED Image is handed over without
+//           copying; an IMAGE_PLANAR Image is converted first. The Image
+//           must be initialized again before it is used.
+Byte_rgb* Image_release_interleaved(Image* img);
+
+// REQUIRES: img points to a valid Image
+// EFFECTS:  Returns the layout of the Image.
+Image_layout Image_get_layout(const Image* img);
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  Converts the Image to the given layout, keeping its pixels.
+//           Does nothing if the Image already has that layout.
+void Image_set_layout(Image* img, Image_layout layout);
+
+// REQUIRES: img points to an Image
+//           is contains an image in plain (P3) or binary (P6) PPM format
+// MODIFIES: *img, is
 // EFFECTS:  Initializes the Image by reading in an image in PPM format
-//           from the given input stream.
+//           from the given input stream. The format is detected from the
+//           magic number. Whitespace and '#' comments may appear anywhere
+//           the PPM spec allows them (and between P3 pixel values).
+//           Values are decoded straight from the stream's buffer into the
+//           channels, without any per-value allocation.
+//           Throws Ppm_error if the input is not a valid PPM image.
 // NOTE:     See the project spec for a discussion of PPM format.
-// NOTE:     Do NOT use new or delete here.
 void Image_init(Image* img, std::istream& is);
 
+// REQUIRES: img points to an Image
+//           is contains an image in plain (P3) or binary (P6) PPM format
+// MODIFIES: *img, is
+// EFFECTS:  Like Image_init(img, is), but the Image gets the given layout.
+//           An IMAGE_INTERLEAVED Image reads binary pixel data straight
+//           into its storage, with a single bulk read.
+void Image_init(Image* img, std::istream& is, Image_layout layout);
+
+// REQUIRES: img points to an Image
+// MODIFIES: *img
+// EFFECTS:  Initializes the Image from the PPM file with the given name,
+//           like Image_init(img, is). The file is memory-mapped where the
+//           platform supports it, and read through a large buffer
+//           otherwise. Returns false if the file cannot be opened.
+//           Throws Ppm_error if it is not a valid PPM image.
+bool Image_init_from_file(Image* img, const std::string& filename);
+
+// REQUIRES: img points to an Image
+// MODIFIES: *img
+// EFFECTS:  Like Image_init_from_file(img, filename), but the Image gets
+//           the given layout.
+bool Image_init_from_file(Image* img, const std::string& filename,
+                          Image_layout layout);
+
 // REQUIRES: img points to a valid Image
 // MODIFIES: os
 // EFFECTS:  Writes the image to the given output stream in PPM format.
@@ -60,8 +154,23 @@ void Image_init(Image* img, std::istream& is);
 //           int is followed by a space. This means that there will be an
 //           "extra" space at the end of each line. See the project spec
 //           for an example.
+// NOTE:     The text is formatted into a buffer and written in chunks of
+//           PRINT_CHUNK_SIZE; os is flushed once, at the end.
 void Image_print(const Image* img, std::ostream& os);
 
+// REQUIRES: img points to a valid Image
+// MODIFIES: os
+// EFFECTS:  Writes the image to the given output stream in the given PPM
+//           format. PPM_PLAIN output is exactly what Image_print(img, os)
+//           writes. PPM_BINARY output has the header
+//             P6 [newline]
+//             WIDTH [space] HEIGHT [newline]
+//             255 [newline]
+//           followed by the red, green and blue bytes of each pixel, row
+//           by row, with no separators. The rows of an IMAGE_INTERLEAVED
+//           Image are written as they are stored.
+void Image_print(const Image* img, std::ostream& os, Ppm_format format);
+
 // REQUIRES: img points to a valid Image
 // EFFECTS:  Returns the width of the Image.
 int Image_width(const Image* img);
@@ -80,14 +189,64 @@ Pixel Image_get_pixel(const Image* img, int row, int column);
 // REQUIRES: img points to a valid Image
 //           0 <= row && row < Image_height(img)
 //           0 <= column && column < Image_width(img)
+//           0 <= each component of color <= MAX_INTENSITY
 // MODIFIES: *img
 // EFFECTS:  Sets the pixel in the Image at the given row and column
 //           to the given color.
 void Image_set_pixel(Image* img, int row, int column, Pixel color);
 
 // REQUIRES: img points to a valid Image
+//           0 <= each component of color <= MAX_INTENSITY
 // MODIFIES: *img
 // EFFECTS:  Sets each pixel in the image to the given color.
 void Image_fill(Image* img, Pixel color);
 
+// REQUIRES: img points to a valid IMAGE_PLANAR Image
+//           0 <= row && row < Image_height(img)
+// MODIFIES: (The returned span may be used to modify the Image.)
+// EFFECTS:  Returns the Image_width(img) values of the given channel in
+//           the given row.
+// NOTE:     Defined here so hot loops inline it. The layout and row are
+//           only checked by assert.
+inline Matrix_span<uint8_t> Image_channel_row(Image* img, Image_channel channel,
+                                              int row) {
+  assert(img->layout == IMAGE_PLANAR);
+  Byte_matrix* channels[3] = {&img->red_channel, &img->green_channel,
+                              &img->blue_channel};
+  return Matrix_row_span(channels[channel], row);
+}
+
+// REQUIRES: img points to a valid IMAGE_PLANAR Image
+//           0 <= row && row < Image_height(img)
+// EFFECTS:  Returns the Image_width(img) values of the given channel in
+//           the given row, read-only.
+inline Matrix_span<const uint8_t> Image_channel_row(const Image* img,
+                                                    Image_channel channel,
+                                                    int row) {
+  assert(img->layout == IMAGE_PLANAR);
+  const Byte_matrix* channels[3] = {&img->red_channel, &img->green_channel,
+                                    &img->blue_channel};
+  return Matrix_row_span(channels[channel], row);
+}
+
+// REQUIRES: img points to a valid IMAGE_INTERLEAVED Image
+//           0 <= row && row < Image_height(img)
+// MODIFIES: (The returned span may be used to modify the Image.)
+// EFFECTS:  Returns the Image_width(img) pixels of the given row.
+// NOTE:     Defined here so hot loops inline it. The layout and row are
+//           only checked by assert.
+inline Matrix_span<Byte_rgb> Image_pixel_row(Image* img, int row) {
+  assert(img->layout == IMAGE_INTERLEAVED);
+  return Matrix_row_span(&img->pixels, row);
+}
+
+// REQUIRES: img points to a valid IMAGE_INTERLEAVED Image
+//           0 <= row && row < Image_height(img)
+// EFFECTS:  Returns the Image_width(img) pixels of the given row,
+//           read-only.
+inline Matrix_span<const Byte_rgb> Image_pixel_row(const Image* img, int row) {
+  assert(img->layout == IMAGE_INTERLEAVED);
+  return Matrix_row_span(&img->pixels, row);
+}
+
 #endif // IMAGE_H
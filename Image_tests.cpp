@@ -184,7 +184,222 @@ TEST(test_image_fiil_basic){
   delete img; // delete the Image    
 }
 
+// Tests that an Image larger than the old 500x500 cap can be created.
+TEST(test_image_init_large){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image_init(img, 1200, 800);
+  Pixel fill_color = {1, 2, 3};
+  Image_fill(img, fill_color);
+
+  ASSERT_EQUAL(Image_width(img), 1200);
+  ASSERT_EQUAL(Image_height(img), 800);
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(img, 799, 1199), fill_color));
+
+  delete img; // delete the Image
+}
+
+// Reads a 2x1 binary PPM whose bytes include values that are whitespace
+// in ASCII, and checks the pixels are decoded exactly.
+TEST(test_image_init_binary_ppm){
+  Image *img = new Image; // create an Image in dynamic memory
+
+  string input = "P6\n2 1\n255\n";
+  const char pixels[] = {10, 32, 0, (char)255, 9, (char)128};
+  input.append(pixels, 6);
+  istringstream is(input);
+  Image_init(img, is);
+
+  ASSERT_EQUAL(Image_width(img), 2);
+  ASSERT_EQUAL(Image_height(img), 1);
+  Pixel first = {10, 32, 0};
+  Pixel second = {255, 9, 128};
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(img, 0, 0), first));
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(img, 0, 1), second));
+
+  delete img; // delete the Image
+}
+
+// Writes an Image as binary PPM, reads it back, and checks the header and
+// that the round trip preserves every pixel.
+TEST(test_image_print_binary_round_trip){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *read_img = new Image;
+
+  Image_init(img, 3, 2);
+  for (int r = 0; r < 2; ++r){
+    for (int c = 0; c < 3; ++c){
+      Pixel color = {r * 100 + c, 255 - c, 13 * r};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  ostringstream os;
+  Image_print(img, os, PPM_BINARY);
+  const string output = os.str();
+  const string header = "P6\n3 2\n255\n";
+  ASSERT_EQUAL(output.substr(0, header.size()), header);
+  ASSERT_EQUAL(output.size(), header.size() + 18);
+
+  istringstream is(output);
+  Image_init(read_img, is);
+  ASSERT_TRUE(Image_equal(img, read_img));
+
+  delete img; // delete the Image
+  delete read_img;
+}
+
+// Reads a plain PPM with comments in the header and between pixel values,
+// and checks it matches the same image without comments.
+TEST(test_image_init_ppm_comments){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *correct_img = new Image;
+
+  string input = "P3 # plain\n# made by hand\n2 1 255#max\n";
+  input += "1 2 3 # first pixel\n\t4\r\n5 6";
+  istringstream is(input);
+  Image_init(img, is);
+
+  istringstream correct_is("P3\n2 1\n255\n1 2 3 4 5 6 \n");
+  Image_init(correct_img, correct_is);
+  ASSERT_TRUE(Image_equal(img, correct_img));
+
+  delete img; // delete the Image
+  delete correct_img;
+}
+
+// Checks that malformed inputs are reported with Ppm_error.
+TEST(test_image_init_ppm_malformed){
+  Image *img = new Image; // create an Image in dynamic memory
+
+  const string inputs[] = {
+    "P5\n1 1\n255\n0",              // unsupported format
+    "P3\n2 1\n255\n1 2 3 4 5",      // truncated pixel data
+    "P3\n1 1\n255\n1 256 3",        // value above the maximum
+    "P3\n1 1\n255\n1 x 3",          // not a number
+    "P3\n1 1\n100\n1 2 3",          // unsupported maximum value
+    "P6\n2 1\n255\nabc",            // truncated binary data
+  };
+  for (const string& input : inputs){
+    istringstream is(input);
+    bool threw = false;
+    try {
+      Image_init(img, is);
+    }
+    catch (Ppm_error&) {
+      threw = true;
+    }
+    ASSERT_TRUE(threw);
+  }
+
+  delete img; // delete the Image
+}
+
  
+// Checks that an interleaved Image reads, prints and converts to and from
+// the planar layout without changing any pixel.
+TEST(test_image_interleaved_layout){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *interleaved = new Image;
+
+  Image_init(img, 3, 2);
+  for (int r = 0; r < 2; ++r){
+    for (int c = 0; c < 3; ++c){
+      Pixel color = {r * 100 + c, 255 - c, 13 * r};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  ASSERT_EQUAL(Image_get_layout(img), IMAGE_PLANAR);
+
+  for (Ppm_format format : {PPM_PLAIN, PPM_BINARY}){
+    ostringstream planar_os;
+    Image_print(img, planar_os, format);
+    istringstream is(planar_os.str());
+    Image_init(interleaved, is, IMAGE_INTERLEAVED);
+    ASSERT_EQUAL(Image_get_layout(interleaved), IMAGE_INTERLEAVED);
+    ASSERT_TRUE(Image_equal(img, interleaved));
+    ostringstream interleaved_os;
+    Image_print(interleaved, interleaved_os, format);
+    ASSERT_EQUAL(interleaved_os.str(), planar_os.str());
+  }
+
+  Image_set_layout(img, IMAGE_INTERLEAVED);
+  ASSERT_TRUE(Image_equal(img, interleaved));
+  Image_set_layout(img, IMAGE_PLANAR);
+  ASSERT_TRUE(Image_equal(img, interleaved));
+
+  const Pixel gray = {7, 7, 7};
+  Image_fill(interleaved, gray);
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(interleaved, 1, 2), gray));
+
+  delete img; // delete the Image
+  delete interleaved;
+}
+
+// Checks that a decoded interleaved buffer becomes an Image and comes back
+// out of it without being copied.
+TEST(test_image_init_interleaved_adopts_buffer){
+  Image *img = new Image; // create an Image in dynamic memory
+
+  Byte_rgb* pixels = new Byte_rgb[4];
+  for (int i = 0; i < 4; ++i){
+    pixels[i].r = static_cast<uint8_t>(i);
+    pixels[i].g = static_cast<uint8_t>(10 * i);
+    pixels[i].b = static_cast<uint8_t>(100 + i);
+  }
+  Image_init_interleaved(img, 2, 2, pixels);
+  Pixel expected = {3, 30, 103};
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(img, 1, 1), expected));
+
+  Byte_rgb* released = Image_release_interleaved(img);
+  ASSERT_EQUAL(released, pixels);
+  delete[] released;
+
+  delete img; // delete the Image
+}
+
+TEST(test_image_row_spans){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image_init(img, 3, 2);
+  for (int r = 0; r < 2; ++r){
+    for (int c = 0; c < 3; ++c){
+      Pixel color = {r * 100 + c, 255 - c, 13 * r};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+
+  // Each channel row holds that channel of every pixel in the row.
+  for (int r = 0; r < 2; ++r){
+    Matrix_span<const uint8_t> red = Image_channel_row(img, IMAGE_RED, r);
+    Matrix_span<const uint8_t> green = Image_channel_row(img, IMAGE_GREEN, r);
+    Matrix_span<const uint8_t> blue = Image_channel_row(img, IMAGE_BLUE, r);
+    ASSERT_EQUAL(red.length, 3);
+    for (int c = 0; c < 3; ++c){
+      Pixel color = Image_get_pixel(img, r, c);
+      ASSERT_EQUAL(red[c], color.r);
+      ASSERT_EQUAL(green[c], color.g);
+      ASSERT_EQUAL(blue[c], color.b);
+    }
+  }
+  Image_channel_row(img, IMAGE_GREEN, 1)[2] = 42;
+  ASSERT_EQUAL(Image_get_pixel(img, 1, 2).g, 42);
+
+  // Interleaved rows hold whole pixels.
+  Image_set_layout(img, IMAGE_INTERLEAVED);
+  for (int r = 0; r < 2; ++r){
+    Matrix_span<const Byte_rgb> row = Image_pixel_row(img, r);
+    ASSERT_EQUAL(row.length, 3);
+    for (int c = 0; c < 3; ++c){
+      Pixel color = Image_get_pixel(img, r, c);
+      ASSERT_EQUAL(row[c].r, color.r);
+      ASSERT_EQUAL(row[c].g, color.g);
+      ASSERT_EQUAL(row[c].b, color.b);
+    }
+  }
+  Image_pixel_row(img, 0)[1].b = 7;
+  ASSERT_EQUAL(Image_get_pixel(img, 0, 1).b, 7);
+
+  delete img; // delete the Image
+}
+
 // NOTE: The unit test framework tutorial in Lab 2 originally
 // had a semicolon after TEST_MAIN(). Although including and
 // excluding the semicolon are both correct according to the c++
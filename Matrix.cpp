@@ -1,18 +1,130 @@
 #include <cassert>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 #include "Matrix.h"
 using namespace std;
 
+// EFFECTS: Returns the number of elements in use by mat.
+template <typename T>
+static int Matrix_size(const Basic_matrix<T>* mat) {
+  return mat->width * mat->height;
+}
+
+// REQUIRES: mat has been constructed
+// MODIFIES: *mat
+// EFFECTS:  Makes sure mat can hold at least size elements. Existing
+//           element values are not preserved if storage is replaced.
+template <typename T>
+static void Matrix_reserve(Basic_matrix<T>* mat, int size) {
+  if (size <= mat->capacity) {
+    return;
+  }
+  if (mat->data != mat->small_data) {
+    delete[] mat->data;
+  }
+  mat->data = new T[size];
+  mat->capacity = size;
+}
+
+// REQUIRES: dst can hold Matrix_size(src) elements
+// MODIFIES: *dst
+// EFFECTS:  Copies the elements of src into dst packed, row after row.
+template <typename T>
+static void Matrix_copy_packed(T* dst, const Basic_matrix<T>* src) {
+  if (src->stride == src->width) {
+    memcpy(dst, src->data, sizeof(T) * Matrix_size(src));
+    return;
+  }
+  for (int r = 0; r < src->height; ++r) {
+    memcpy(dst + r * src->width, src->data + r * src->stride,
+           sizeof(T) * src->width);
+  }
+}
+
+template <typename T>
+Basic_matrix<T>::Basic_matrix()
+  : width(0), height(0), stride(0), data(small_data),
+    capacity(MATRIX_SMALL_CAPACITY) {}
+
+template <typename T>
+Basic_matrix<T>::Basic_matrix(const Basic_matrix& other) : Basic_matrix() {
+  *this = other;
+}
+
+template <typename T>
+Basic_matrix<T>::Basic_matrix(Basic_matrix&& other) noexcept : Basic_matrix() {
+  *this = std::move(other);
+}
+
+template <typename T>
+Basic_matrix<T>& Basic_matrix<T>::operator=(const Basic_matrix& other) {
+  if (this != &other) {
+    Matrix_reserve(this, Matrix_size(&other));
+    width = other.width;
+    height = other.height;
+    stride = other.width;
+    Matrix_copy_packed(data, &other);
+  }
+  return *this;
+}
+
+template <typename T>
+Basic_matrix<T>& Basic_matrix<T>::operator=(Basic_matrix&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  if (other.data == other.small_data) {
+    // Inline storage cannot be stolen; it is small, so just copy it.
+    width = other.width;
+    height = other.height;
+    stride = other.width;
+    Matrix_copy_packed(data, &other);
+    return *this;
+  }
+  if (data != small_data) {
+    delete[] data;
+  }
+  width = other.width;
+  height = other.height;
+  stride = other.stride;
+  data = other.data;
+  capacity = other.capacity;
+  other.width = 0;
+  other.height = 0;
+  other.stride = 0;
+  other.data = other.small_data;
+  other.capacity = MATRIX_SMALL_CAPACITY;
+  return *this;
+}
+
+template <typename T>
+Basic_matrix<T>::~Basic_matrix() {
+  if (data != small_data) {
+    delete[] data;
+  }
+}
+
 // REQUIRES: mat points to a Matrix
-//           0 < width && width <= MAX_MATRIX_WIDTH
-//           0 < height && height <= MAX_MATRIX_HEIGHT
+//           0 < width && 0 < height
 // MODIFIES: *mat
 // EFFECTS:  Initializes *mat as a Matrix with the given width and height.
-// NOTE:     Do NOT use new or delete here.
-void Matrix_init(Matrix* mat, int width, int height) {
-  assert(0 < width && width <= MAX_MATRIX_WIDTH);
-  assert(0 < height && height <= MAX_MATRIX_HEIGHT);
+//           Storage is grown if needed and reused otherwise, so
+//           re-initializing a Matrix to the same or a smaller size does
+//           not allocate. Element values are unspecified afterwards.
+template <typename T>
+void Matrix_init(Basic_matrix<T>* mat, int width, int height) {
+  assert(0 < width && 0 < height);
+  assert(width <= INT_MAX / height);
+  Matrix_reserve(mat, width * height);
   mat->width = width;
   mat->height = height;
+  mat->stride = width;
 }
 
 // REQUIRES: mat points to a valid Matrix
@@ -23,46 +135,98 @@ void Matrix_init(Matrix* mat, int width, int height) {
 //           Each element is followed by a space and each row is followed
 //           by a newline. This means there will be an "extra" space at
 //           the end of each line.
-void Matrix_print(const Matrix* mat, ostream& os) {
-  os << Matrix_width(mat) << " " << Matrix_height(mat) << endl;
-  
-  // Prints each row in the Matrix to os.
+template <typename T>
+void Matrix_print(const Basic_matrix<T>* mat, ostream& os) {
+  os << Matrix_width(mat) << " " << Matrix_height(mat) << "\n";
+
+  // Prints each row in the Matrix to os, one buffer-full at a time.
+  vector<char> buffer(PRINT_CHUNK_SIZE);
+  char* const flush_point = buffer.data() + PRINT_CHUNK_SIZE - MATRIX_ELEMENT_TEXT_MAX;
+  char* out = buffer.data();
   for (int r = 0; r < Matrix_height(mat); ++r){
+    const T* row = Matrix_at(mat, r, 0);
     for (int c = 0; c < Matrix_width(mat); ++c){
-      os << *Matrix_at(mat, r, c) << " ";
+      if (out >= flush_point){
+        os.write(buffer.data(), out - buffer.data());
+        out = buffer.data();
+      }
+      out = Matrix_format_element(out, row[c]);
     }
-    os << endl;
-  }  
+    *out++ = '\n';
+  }
+  os.write(buffer.data(), out - buffer.data());
+  os.flush();
+}
+
+// Text of an element with a value from 0 to 255, followed by a space.
+struct Small_element_text {
+  char text[4];
+  int length;
+};
+
+// EFFECTS: Returns the lookup table used by Matrix_format_element.
+static const Small_element_text* small_element_texts() {
+  static const vector<Small_element_text> table = [] {
+    vector<Small_element_text> texts(256);
+    for (int value = 0; value < 256; ++value){
+      const string text = to_string(value) + " ";
+      text.copy(texts[value].text, text.size());
+      texts[value].length = text.size();
+    }
+    return texts;
+  }();
+  return table.data();
+}
+
+// REQUIRES: out points to at least MATRIX_ELEMENT_TEXT_MAX chars
+// MODIFIES: out[0]...
+// EFFECTS:  Writes value in decimal followed by a space, exactly as
+//           os << value << " " does on a default-formatted stream, and
+//           returns a pointer just past the last char written. Values
+//           from 0 to 255 are copied from a lookup table.
+char* Matrix_format_element(char* out, int value) {
+  if (0 <= value && value < 256){
+    const Small_element_text& small = small_element_texts()[value];
+    memcpy(out, small.text, 4);
+    return out + small.length;
+  }
+  out = to_chars(out, out + MATRIX_ELEMENT_TEXT_MAX - 1, value).ptr;
+  *out++ = ' ';
+  return out;
 }
 
 // REQUIRES: mat points to an valid Matrix
 // EFFECTS:  Returns the width of the Matrix.
-int Matrix_width(const Matrix* mat) {
+template <typename T>
+int Matrix_width(const Basic_matrix<T>* mat) {
   return mat->width;
 }
 
 // REQUIRES: mat points to a valid Matrix
 // EFFECTS:  Returns the height of the Matrix.
-int Matrix_height(const Matrix* mat) {
+template <typename T>
+int Matrix_height(const Basic_matrix<T>* mat) {
   return mat->height;
 }
 
 // REQUIRES: mat points to a valid Matrix
 //           ptr points to an element in the Matrix
 // EFFECTS:  Returns the row of the element pointed to by ptr.
-int Matrix_row(const Matrix* mat, const int* ptr) {
-  const int* start_ptr = &mat->data[0];
+template <typename T>
+int Matrix_row(const Basic_matrix<T>* mat, const T* ptr) {
+  const T* start_ptr = &mat->data[0];
   const int index = (ptr - start_ptr); 
-  return index / Matrix_width(mat); // floor division
+  return index / mat->stride; // floor division
 }
 
 // REQUIRES: mat points to a valid Matrix
 //           ptr point to an element in the Matrix
 // EFFECTS:  Returns the column of the element pointed to by ptr.
-int Matrix_column(const Matrix* mat, const int* ptr) {
-  const int* start_ptr = &mat->data[0];
+template <typename T>
+int Matrix_column(const Basic_matrix<T>* mat, const T* ptr) {
+  const T* start_ptr = &mat->data[0];
   const int index = (ptr - start_ptr); 
-  return index % Matrix_width(mat);
+  return index % mat->stride;
 }
 
 // REQUIRES: mat points to a valid Matrix
@@ -73,11 +237,12 @@ int Matrix_column(const Matrix* mat, const int* ptr) {
 //            element in the Matrix.)
 // EFFECTS:  Returns a pointer to the element in the Matrix
 //           at the given row and column.
-int* Matrix_at(Matrix* mat, int row, int column) {
+template <typename T>
+T* Matrix_at(Basic_matrix<T>* mat, int row, int column) {
   assert(0 <= row && row < Matrix_height(mat));
   assert(0 <= column && column < Matrix_width(mat));   
-  const int index = Matrix_width(mat) * row + column; 
-  int* element_ptr = &mat->data[index];
+  const int index = mat->stride * row + column;
+  T* element_ptr = &mat->data[index];
   return element_ptr;
 }
 
@@ -87,57 +252,73 @@ int* Matrix_at(Matrix* mat, int row, int column) {
 //
 // EFFECTS:  Returns a pointer-to-const to the element in
 //           the Matrix at the given row and column.
-const int* Matrix_at(const Matrix* mat, int row, int column) {
+template <typename T>
+const T* Matrix_at(const Basic_matrix<T>* mat, int row, int column) {
   assert(0 <= row && row < Matrix_height(mat));
   assert(0 <= column && column < Matrix_width(mat));   
-  const int index = Matrix_width(mat) * row + column; 
-  const int* c_element_ptr = &mat->data[index];
+  const int index = mat->stride * row + column;
+  const T* c_element_ptr = &mat->data[index];
   return c_element_ptr;
 }
 
+// EFFECTS: Returns whether value can be stored in a T unchanged.
+template <typename T>
+[[maybe_unused]] static bool Matrix_value_fits(int value) {
+  return numeric_limits<T>::min() <= value && value <= numeric_limits<T>::max();
+}
+
 // REQUIRES: mat points to a valid Matrix
+//           value fits in T
 // MODIFIES: *mat
 // EFFECTS:  Sets each element of the Matrix to the given value.
-void Matrix_fill(Matrix* mat, int value) {
+template <typename T>
+void Matrix_fill(Basic_matrix<T>* mat, int value) {
+  assert(Matrix_value_fits<T>(value));
   const int height = Matrix_height(mat);
   const int width = Matrix_width(mat);
   for (int r = 0; r < height; ++r){
     for (int c = 0; c < width; ++c){
-      int* element_ptr = Matrix_at(mat, r, c);
-      *element_ptr = value;
+      T* element_ptr = Matrix_at(mat, r, c);
+      *element_ptr = static_cast<T>(value);
     }
   }
 }
 
 // REQUIRES: mat points to a valid Matrix
+//           value fits in T
 // MODIFIES: *mat
 // EFFECTS:  Sets each element on the border of the Matrix to
 //           the given value. These are all elements in the first/last
 //           row or the first/last column.
-void Matrix_fill_border(Matrix* mat, int value) {
+template <typename T>
+void Matrix_fill_border(Basic_matrix<T>* mat, int value) {
+  assert(Matrix_value_fits<T>(value));
   const int height = Matrix_height(mat);
   const int width = Matrix_width(mat);
   const int max_row = height - 1;
   const int max_column = width - 1;
-  for (int r = 0; r < height; ++r){
-    for (int c = 0; c < width; ++c){
-      if (r == 0 || r == max_row || c == 0 || c == max_column){
-        int* element_ptr = Matrix_at(mat, r, c);
-        *element_ptr = value;
-      }  
-    }
-  }   
+  // Only the border elements are visited, so this is O(width + height).
+  for (int c = 0; c < width; ++c){
+    *Matrix_at(mat, 0, c) = static_cast<T>(value);
+    *Matrix_at(mat, max_row, c) = static_cast<T>(value);
+  }
+  for (int r = 1; r < max_row; ++r){
+    *Matrix_at(mat, r, 0) = static_cast<T>(value);
+    *Matrix_at(mat, r, max_column) = static_cast<T>(value);
+  }
 }
 
 // REQUIRES: mat points to a valid Matrix
-// EFFECTS:  Returns the value of the maximum element in the Matrix
-int Matrix_max(const Matrix* mat) {
+// EFFECTS:  Returns the value of the maximum element in the Matrix,
+//           widened to int.
+template <typename T>
+int Matrix_max(const Basic_matrix<T>* mat) {
   int max_value = *Matrix_at(mat, 0, 0);
   const int height = Matrix_height(mat);
   const int width = Matrix_width(mat);
   for (int r = 0; r < height; ++r){
     for (int c = 0; c < width; ++c){
-      const int* element_ptr = Matrix_at(mat, r, c);
+      const T* element_ptr = Matrix_at(mat, r, c);
       if (*element_ptr > max_value){
         max_value = *element_ptr;
       }
@@ -156,7 +337,8 @@ int Matrix_max(const Matrix* mat) {
 //           column_end (exclusive).
 //           If multiple elements are minimal, returns the column of
 //           the leftmost one.
-int Matrix_column_of_min_value_in_row(const Matrix* mat, int row,
+template <typename T>
+int Matrix_column_of_min_value_in_row(const Basic_matrix<T>* mat, int row,
                                       int column_start, int column_end) {
   assert(0 <= row && row < Matrix_height(mat));
   assert(0 <= column_start && column_end <= Matrix_width(mat));
@@ -182,10 +364,11 @@ int Matrix_column_of_min_value_in_row(const Matrix* mat, int row,
 //           0 <= row && row < Matrix_height(mat)
 //           0 <= column_start && column_end <= Matrix_width(mat)
 //           column_start < column_end
-// EFFECTS:  Returns the minimal value in a particular region. The region
-//           is defined as elements in the given row and between
-//           column_start (inclusive) and column_end (exclusive).
-int Matrix_min_value_in_row(const Matrix* mat, int row,
+// EFFECTS:  Returns the minimal value in a particular region, widened to
+//           int. The region is defined as elements in the given row and
+//           between column_start (inclusive) and column_end (exclusive).
+template <typename T>
+int Matrix_min_value_in_row(const Basic_matrix<T>* mat, int row,
                             int column_start, int column_end) {
   assert(0 <= row && row < Matrix_height(mat));
   assert(0 <= column_start && column_end <= Matrix_width(mat));
@@ -198,3 +381,217 @@ int Matrix_min_value_in_row(const Matrix* mat, int row,
   }
   return min_value;
 }
+
+// REQUIRES: mat points to a valid Matrix
+//           Matrix_width(mat) >= 2
+//           seam points to an array of length Matrix_height(mat)
+//           each element x in seam satisfies 0 <= x < Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes one element from every row of the Matrix, shifting the
+//           elements to its right one column left. The element removed
+//           from row r is the one with column equal to seam[r]. The width
+//           of the Matrix will be one less than before.
+template <typename T>
+void Matrix_remove_vertical_seam(Basic_matrix<T>* mat, const int seam[]) {
+  assert(Matrix_width(mat) >= 2);
+  Matrix_remove_seam_from_rows(mat, seam, 0, Matrix_height(mat));
+  Matrix_shrink_width(mat, Matrix_width(mat) - 1);
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           Matrix_height(mat) >= 2
+//           seam points to an array of length Matrix_width(mat)
+//           each element x in seam satisfies 0 <= x < Matrix_height(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes one element from every column of the Matrix, shifting
+//           the elements below it one row up. The element removed from
+//           column c is the one with row equal to seam[c]. The height of
+//           the Matrix will be one less than before.
+template <typename T>
+void Matrix_remove_horizontal_seam(Basic_matrix<T>* mat, const int seam[]) {
+  const int width = Matrix_width(mat);
+  const int height = Matrix_height(mat);
+  assert(height >= 2);
+  int first_row = height;
+  for (int c = 0; c < width; ++c){
+    assert(0 <= seam[c] && seam[c] < height);
+    first_row = min(first_row, seam[c]);
+  }
+  // Walks the rows top down so every row is read before it is
+  // overwritten, and each pass streams through two consecutive rows.
+  // Rows above the highest seam element do not move.
+  for (int r = first_row; r < height - 1; ++r){
+    T* row = mat->data + r * mat->stride;
+    const T* next_row = row + mat->stride;
+    for (int c = 0; c < width; ++c){
+      if (r >= seam[c]){
+        row[c] = next_row[c];
+      }
+    }
+  }
+  mat->height = height - 1;
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           0 <= row_start && row_start <= row_end
+//           row_end <= Matrix_height(mat)
+//           each element x in seam[row_start]...seam[row_end-1] satisfies
+//           0 <= x < Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes the element at column seam[r] from each row r in
+//           [row_start, row_end), shifting the elements to its right one
+//           column left. The width is NOT changed; the last column of
+//           those rows is left unspecified until Matrix_shrink_width is
+//           called. Rows are independent, so disjoint row ranges may be
+//           processed concurrently.
+template <typename T>
+void Matrix_remove_seam_from_rows(Basic_matrix<T>* mat, const int seam[],
+                                  int row_start, int row_end) {
+  assert(0 <= row_start && row_start <= row_end);
+  assert(row_end <= Matrix_height(mat));
+  const int width = Matrix_width(mat);
+  for (int r = row_start; r < row_end; ++r){
+    assert(0 <= seam[r] && seam[r] < width);
+    T* row = mat->data + r * mat->stride;
+    memmove(row + seam[r], row + seam[r] + 1,
+            sizeof(T) * (width - seam[r] - 1));
+  }
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           0 < num_seams && num_seams < Matrix_width(mat)
+//           seams points to num_seams vertical seams stored back to back:
+//           seam i, row r is seams[i * Matrix_height(mat) + r]
+//           the seams don't share any element
+// MODIFIES: *mat
+// EFFECTS:  Removes the elements of all the seams, compacting each row
+//           once, and reduces the width by num_seams. The remaining
+//           elements of each row keep their order.
+template <typename T>
+void Matrix_remove_vertical_seams(Basic_matrix<T>* mat, const int seams[],
+                                  int num_seams) {
+  const int width = Matrix_width(mat);
+  const int height = Matrix_height(mat);
+  assert(0 < num_seams && num_seams < width);
+  // Kept between calls so repeated passes do not allocate.
+  static thread_local vector<int> columns;
+  if (columns.size() < static_cast<size_t>(num_seams) + 1){
+    columns.resize(num_seams + 1);
+  }
+  for (int r = 0; r < height; ++r){
+    for (int i = 0; i < num_seams; ++i){
+      columns[i] = seams[i * height + r];
+      assert(0 <= columns[i] && columns[i] < width);
+    }
+    sort(columns.begin(), columns.begin() + num_seams);
+    columns[num_seams] = width;
+
+    // Each run of kept elements between two removed ones moves left by
+    // the number of elements removed before it.
+    T* row = mat->data + r * mat->stride;
+    for (int i = 0; i < num_seams; ++i){
+      assert(columns[i] < columns[i + 1]);
+      memmove(row + columns[i] - i, row + columns[i] + 1,
+              sizeof(T) * (columns[i + 1] - columns[i] - 1));
+    }
+  }
+  Matrix_shrink_width(mat, width - num_seams);
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           0 < width && width <= Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Reduces the width of the Matrix to the given width, keeping
+//           the first width elements of every row in place.
+template <typename T>
+void Matrix_shrink_width(Basic_matrix<T>* mat, int width) {
+  assert(0 < width && width <= Matrix_width(mat));
+  mat->width = width;
+}
+
+// REQUIRES: mat points to a Matrix
+//           0 < width && 0 < height
+//           data was allocated with new T[n] for some n >= width * height
+// MODIFIES: *mat
+// EFFECTS:  Makes the Matrix width by height, stored in data, without
+//           copying. The Matrix takes ownership of data.
+template <typename T>
+void Matrix_adopt(Basic_matrix<T>* mat, T* data, int width, int height) {
+  assert(0 < width && 0 < height);
+  assert(width <= INT_MAX / height);
+  assert(data != mat->data);
+  if (mat->data != mat->small_data) {
+    delete[] mat->data;
+  }
+  mat->width = width;
+  mat->height = height;
+  mat->stride = width;
+  mat->data = data;
+  mat->capacity = width * height;
+}
+
+// REQUIRES: mat points to a valid Matrix
+// MODIFIES: *mat
+// EFFECTS:  Returns the elements of the Matrix packed row after row in a
+//           block the caller must free with delete[], and leaves *mat
+//           empty.
+template <typename T>
+T* Matrix_release(Basic_matrix<T>* mat) {
+  T* data = mat->data;
+  if (data == mat->small_data) {
+    // create a block in dynamic memory for the inline elements
+    data = new T[max(Matrix_size(mat), 1)];
+    Matrix_copy_packed(data, mat);
+  } else if (mat->stride != mat->width) {
+    // Row r moves from r * stride to r * width, never past a row that
+    // has yet to move, so packing in place is safe.
+    for (int r = 1; r < mat->height; ++r) {
+      memmove(data + r * mat->width, data + r * mat->stride,
+              sizeof(T) * mat->width);
+    }
+  }
+  mat->width = 0;
+  mat->height = 0;
+  mat->stride = 0;
+  mat->data = mat->small_data;
+  mat->capacity = MATRIX_SMALL_CAPACITY;
+  return data;
+}
+
+// Defines the Matrix functions that only move elements around, for every
+// element type in Matrix.h.
+#define MATRIX_INSTANTIATE_STORAGE(T)                                      \
+  template struct Basic_matrix<T>;                                         \
+  template void Matrix_init(Basic_matrix<T>*, int, int);                   \
+  template int Matrix_width(const Basic_matrix<T>*);                       \
+  template int Matrix_height(const Basic_matrix<T>*);                      \
+  template int Matrix_row(const Basic_matrix<T>*, const T*);               \
+  template int Matrix_column(const Basic_matrix<T>*, const T*);            \
+  template T* Matrix_at(Basic_matrix<T>*, int, int);                       \
+  template const T* Matrix_at(const Basic_matrix<T>*, int, int);           \
+  template void Matrix_remove_vertical_seam(Basic_matrix<T>*, const int*); \
+  template void Matrix_remove_horizontal_seam(Basic_matrix<T>*,            \
+                                              const int*);                 \
+  template void Matrix_remove_seam_from_rows(Basic_matrix<T>*, const int*, \
+                                             int, int);                    \
+  template void Matrix_remove_vertical_seams(Basic_matrix<T>*, const int*, \
+                                             int);                         \
+  template void Matrix_shrink_width(Basic_matrix<T>*, int);                \
+  template void Matrix_adopt(Basic_matrix<T>*, T*, int, int);              \
+  template T* Matrix_release(Basic_matrix<T>*);
+
+// Defines the rest of the Matrix functions, for the numeric element types.
+#define MATRIX_INSTANTIATE(T)                                              \
+  MATRIX_INSTANTIATE_STORAGE(T)                                            \
+  template void Matrix_print(const Basic_matrix<T>*, ostream&);            \
+  template void Matrix_fill(Basic_matrix<T>*, int);                        \
+  template void Matrix_fill_border(Basic_matrix<T>*, int);                 \
+  template int Matrix_max(const Basic_matrix<T>*);                         \
+  template int Matrix_column_of_min_value_in_row(const Basic_matrix<T>*,   \
+                                                 int, int, int);           \
+  template int Matrix_min_value_in_row(const Basic_matrix<T>*,             \
+                                       int, int, int);
+
+MATRIX_INSTANTIATE(int)
+MATRIX_INSTANTIATE(uint8_t)
+MATRIX_INSTANTIATE_STORAGE(Byte_rgb)
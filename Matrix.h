@@ -5,26 +5,80 @@
 * Matrix.h   
 */
 
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
+// Sizes of the original fixed-capacity Matrix. A Matrix is no longer
+// limited to these dimensions; they are kept for callers that still
+// size fixed buffers (e.g. seam arrays) for images known to fit.
 const int MAX_MATRIX_WIDTH = 500;
 const int MAX_MATRIX_HEIGHT = 500;
 
-// Representation of a 2D matrix of integers
-// Matrix objects may be copied.
-struct Matrix{
+// Number of elements a Matrix stores inline. Matrices with at most this
+// many elements never touch the heap.
+const int MATRIX_SMALL_CAPACITY = 64;
+
+// Representation of a 2D matrix of elements of type T.
+// Row r starts at data + r * stride. stride equals width after
+// Matrix_init; removing seams narrows the rows in place and leaves the
+// stride alone, so rows never have to move relative to each other.
+// Matrix objects may be copied. Copies only move the width * height
+// elements that are in use and are packed (stride == width).
+// The Matrix functions are templates over T, defined in Matrix.cpp for
+// the element types below. Element values are passed and returned as
+// int whatever T is, so the same int-based API works for every type:
+// values returned are widened to int, and values passed in must fit in T.
+template <typename T>
+struct Basic_matrix{
   int width;
   int height;
-  int data[MAX_MATRIX_WIDTH * MAX_MATRIX_HEIGHT];
+  int stride;
+  T* data;       // points to small_data or to a heap block of capacity Ts
+  int capacity;
+  T small_data[MATRIX_SMALL_CAPACITY];
+
+  Basic_matrix();
+  Basic_matrix(const Basic_matrix& other);
+  Basic_matrix(Basic_matrix&& other) noexcept;
+  Basic_matrix& operator=(const Basic_matrix& other);
+  Basic_matrix& operator=(Basic_matrix&& other) noexcept;
+  ~Basic_matrix();
+};
+
+// A Matrix of ints (32 bits on every supported platform), used for
+// energies, costs and anything else that needs the full range.
+typedef Basic_matrix<int> Matrix;
+
+// A Matrix of 8-bit values, used for the color channels of an Image.
+// It moves a quarter of the bytes of a Matrix.
+typedef Basic_matrix<uint8_t> Byte_matrix;
+
+// Three 8-bit values kept side by side, such as the red, green and blue
+// of one pixel of an interleaved Image.
+struct Byte_rgb {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
 };
+static_assert(sizeof(Byte_rgb) == 3, "interleaved rows must be packed bytes");
+
+// A Matrix of Byte_rgb triples, used for interleaved Images. Only the
+// functions that move elements around are defined for it: Matrix_init,
+// the accessors, the seam removals, Matrix_shrink_width, Matrix_adopt
+// and Matrix_release. The ones that treat elements as numbers are not.
+typedef Basic_matrix<Byte_rgb> Rgb_matrix;
 
 // REQUIRES: mat points to a Matrix
-//           0 < width && width <= MAX_MATRIX_WIDTH
-//           0 < height && height <= MAX_MATRIX_HEIGHT
+//           0 < width && 0 < height
 // MODIFIES: *mat
 // EFFECTS:  Initializes *mat as a Matrix with the given width and height.
-// NOTE:     Do NOT use new or delete here.
-void Matrix_init(Matrix* mat, int width, int height);
+//           Storage is grown if needed and reused otherwise, so
+//           re-initializing a Matrix to the same or a smaller size does
+//           not allocate. Element values are unspecified afterwards.
+template <typename T>
+void Matrix_init(Basic_matrix<T>* mat, int width, int height);
 
 // REQUIRES: mat points to a valid Matrix
 // MODIFIES: os
@@ -34,25 +88,48 @@ void Matrix_init(Matrix* mat, int width, int height);
 //           Each element is followed by a space and each row is followed
 //           by a newline. This means there will be an "extra" space at
 //           the end of each line.
-void Matrix_print(const Matrix* mat, std::ostream& os);
+// NOTE:     The text is formatted into a buffer and written in chunks of
+//           PRINT_CHUNK_SIZE; os is flushed once, at the end.
+template <typename T>
+void Matrix_print(const Basic_matrix<T>* mat, std::ostream& os);
+
+// Longest text Matrix_format_element writes: a sign, ten digits and a
+// space.
+const int MATRIX_ELEMENT_TEXT_MAX = 12;
+
+// Size of the chunks in which Matrix_print and Image_print hand their
+// text to the output stream.
+const int PRINT_CHUNK_SIZE = 1 << 16;
+
+// REQUIRES: out points to at least MATRIX_ELEMENT_TEXT_MAX chars
+// MODIFIES: out[0]...
+// EFFECTS:  Writes value in decimal followed by a space, exactly as
+//           os << value << " " does on a default-formatted stream, and
+//           returns a pointer just past the last char written. Values
+//           from 0 to 255 are copied from a lookup table.
+char* Matrix_format_element(char* out, int value);
 
 // REQUIRES: mat points to a valid Matrix
 // EFFECTS:  Returns the width of the Matrix.
-int Matrix_width(const Matrix* mat);
+template <typename T>
+int Matrix_width(const Basic_matrix<T>* mat);
 
 // REQUIRES: mat points to a valid Matrix
 // EFFECTS:  Returns the height of the Matrix.
-int Matrix_height(const Matrix* mat);
+template <typename T>
+int Matrix_height(const Basic_matrix<T>* mat);
 
 // REQUIRES: mat points to a valid Matrix
 //           ptr points to an element in the Matrix
 // EFFECTS:  Returns the row of the element pointed to by ptr.
-int Matrix_row(const Matrix* mat, const int* ptr);
+template <typename T>
+int Matrix_row(const Basic_matrix<T>* mat, const T* ptr);
 
 // REQUIRES: mat points to a valid Matrix
 //           ptr point to an element in the Matrix
 // EFFECTS:  Returns the column of the element pointed to by ptr.
-int Matrix_column(const Matrix* mat, const int* ptr);
+template <typename T>
+int Matrix_column(const Basic_matrix<T>* mat, const T* ptr);
 
 // REQUIRES: mat points to a valid Matrix
 //           0 <= row && row < Matrix_height(mat)
@@ -62,7 +139,8 @@ int Matrix_column(const Matrix* mat, const int* ptr);
 //            element in the Matrix.)
 // EFFECTS:  Returns a pointer to the element in the Matrix
 //           at the given row and column.
-int* Matrix_at(Matrix* mat, int row, int column);
+template <typename T>
+T* Matrix_at(Basic_matrix<T>* mat, int row, int column);
 
 // REQUIRES: mat points to a valid Matrix
 //           0 <= row && row < Matrix_height(mat)
@@ -70,23 +148,77 @@ int* Matrix_at(Matrix* mat, int row, int column);
 //
 // EFFECTS:  Returns a pointer-to-const to the element in
 //           the Matrix at the given row and column.
-const int* Matrix_at(const Matrix* mat, int row, int column);
+template <typename T>
+const T* Matrix_at(const Basic_matrix<T>* mat, int row, int column);
+
+// A row of a Matrix: length elements stored one after the other from
+// data. Indexing is checked with assert only, so it costs nothing in
+// builds with NDEBUG defined.
+template <typename T>
+struct Matrix_span {
+  T* data;
+  int length;
+
+  T& operator[](int i) const {
+    assert(0 <= i && i < length);
+    return data[i];
+  }
+  T* begin() const { return data; }
+  T* end() const { return data + length; }
+
+  // A span of elements can always be read as a span of const elements.
+  operator Matrix_span<const T>() const {
+    return Matrix_span<const T>{data, length};
+  }
+};
+
+// REQUIRES: mat points to a valid Matrix
+//           0 <= row && row < Matrix_height(mat)
+// MODIFIES: (The returned span may be used to modify elements in the
+//            Matrix.)
+// EFFECTS:  Returns the Matrix_width(mat) elements of the given row.
+// NOTE:     Unlike the other Matrix functions this is defined here, so
+//           loops over rows inline it instead of calling Matrix_at for
+//           every element. The row is only checked by assert.
+template <typename T>
+inline Matrix_span<T> Matrix_row_span(Basic_matrix<T>* mat, int row) {
+  assert(0 <= row && row < mat->height);
+  return Matrix_span<T>{mat->data + static_cast<std::size_t>(row) * mat->stride,
+                        mat->width};
+}
 
 // REQUIRES: mat points to a valid Matrix
+//           0 <= row && row < Matrix_height(mat)
+// EFFECTS:  Returns the Matrix_width(mat) elements of the given row,
+//           read-only.
+template <typename T>
+inline Matrix_span<const T> Matrix_row_span(const Basic_matrix<T>* mat, int row) {
+  assert(0 <= row && row < mat->height);
+  return Matrix_span<const T>{mat->data + static_cast<std::size_t>(row) * mat->stride,
+                              mat->width};
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           value fits in T
 // MODIFIES: *mat
 // EFFECTS:  Sets each element of the Matrix to the given value.
-void Matrix_fill(Matrix* mat, int value);
+template <typename T>
+void Matrix_fill(Basic_matrix<T>* mat, int value);
 
 // REQUIRES: mat points to a valid Matrix
+//           value fits in T
 // MODIFIES: *mat
 // EFFECTS:  Sets each element on the border of the Matrix to
 //           the given value. These are all elements in the first/last
 //           row or the first/last column.
-void Matrix_fill_border(Matrix* mat, int value);
+template <typename T>
+void Matrix_fill_border(Basic_matrix<T>* mat, int value);
 
 // REQUIRES: mat points to a valid Matrix
-// EFFECTS:  Returns the value of the maximum element in the Matrix
-int Matrix_max(const Matrix* mat);
+// EFFECTS:  Returns the value of the maximum element in the Matrix,
+//           widened to int.
+template <typename T>
+int Matrix_max(const Basic_matrix<T>* mat);
 
 // REQUIRES: mat points to a valid Matrix
 //           0 <= row && row < Matrix_height(mat)
@@ -98,17 +230,101 @@ int Matrix_max(const Matrix* mat);
 //           column_end (exclusive).
 //           If multiple elements are minimal, returns the column of
 //           the leftmost one.
-int Matrix_column_of_min_value_in_row(const Matrix* mat, int row,
+template <typename T>
+int Matrix_column_of_min_value_in_row(const Basic_matrix<T>* mat, int row,
                                       int column_start, int column_end);
 
 // REQUIRES: mat points to a valid Matrix
 //           0 <= row && row < Matrix_height(mat)
 //           0 <= column_start && column_end <= Matrix_width(mat)
 //           column_start < column_end
-// EFFECTS:  Returns the minimal value in a particular region. The region
-//           is defined as elements in the given row and between
-//           column_start (inclusive) and column_end (exclusive).
-int Matrix_min_value_in_row(const Matrix* mat, int row,
+// EFFECTS:  Returns the minimal value in a particular region, widened to
+//           int. The region is defined as elements in the given row and
+//           between column_start (inclusive) and column_end (exclusive).
+template <typename T>
+int Matrix_min_value_in_row(const Basic_matrix<T>* mat, int row,
                             int column_start, int column_end);
 
+// REQUIRES: mat points to a valid Matrix
+//           Matrix_width(mat) >= 2
+//           seam points to an array of length Matrix_height(mat)
+//           each element x in seam satisfies 0 <= x < Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes one element from every row of the Matrix, shifting the
+//           elements to its right one column left. The element removed
+//           from row r is the one with column equal to seam[r]. The width
+//           of the Matrix will be one less than before.
+template <typename T>
+void Matrix_remove_vertical_seam(Basic_matrix<T>* mat, const int seam[]);
+
+// REQUIRES: mat points to a valid Matrix
+//           Matrix_height(mat) >= 2
+//           seam points to an array of length Matrix_width(mat)
+//           each element x in seam satisfies 0 <= x < Matrix_height(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes one element from every column of the Matrix, shifting
+//           the elements below it one row up. The element removed from
+//           column c is the one with row equal to seam[c]. The height of
+//           the Matrix will be one less than before.
+template <typename T>
+void Matrix_remove_horizontal_seam(Basic_matrix<T>* mat, const int seam[]);
+
+// REQUIRES: mat points to a valid Matrix
+//           0 <= row_start && row_start <= row_end
+//           row_end <= Matrix_height(mat)
+//           each element x in seam[row_start]...seam[row_end-1] satisfies
+//           0 <= x < Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Removes the element at column seam[r] from each row r in
+//           [row_start, row_end), shifting the elements to its right one
+//           column left. The width is NOT changed; the last column of
+//           those rows is left unspecified until Matrix_shrink_width is
+//           called. Rows are independent, so disjoint row ranges may be
+//           processed concurrently.
+template <typename T>
+void Matrix_remove_seam_from_rows(Basic_matrix<T>* mat, const int seam[],
+                                  int row_start, int row_end);
+
+// REQUIRES: mat points to a valid Matrix
+//           0 < num_seams && num_seams < Matrix_width(mat)
+//           seams points to num_seams vertical seams stored back to back:
+//           seam i, row r is seams[i * Matrix_height(mat) + r]
+//           the seams don't share any element
+// MODIFIES: *mat
+// EFFECTS:  Removes the elements of all the seams, compacting each row
+//           once, and reduces the width by num_seams. The remaining
+//           elements of each row keep their order.
+template <typename T>
+void Matrix_remove_vertical_seams(Basic_matrix<T>* mat, const int seams[],
+                                  int num_seams);
+
+// REQUIRES: mat points to a valid Matrix
+//           0 < width && width <= Matrix_width(mat)
+// MODIFIES: *mat
+// EFFECTS:  Reduces the width of the Matrix to the given width, keeping
+//           the first width elements of every row in place.
+template <typename T>
+void Matrix_shrink_width(Basic_matrix<T>* mat, int width);
+
+// REQUIRES: mat points to a Matrix
+//           0 < width && 0 < height
+//           data was allocated with new T[n] for some n >= width * height
+// MODIFIES: *mat
+// EFFECTS:  Makes the Matrix width by height, stored in data, without
+//           copying: element (r, c) is data[r * width + c]. The Matrix
+//           takes ownership of data and frees its previous storage.
+template <typename T>
+void Matrix_adopt(Basic_matrix<T>* mat, T* data, int width, int height);
+
+// REQUIRES: mat points to a valid Matrix
+// MODIFIES: *mat
+// EFFECTS:  Returns the elements of the Matrix packed row after row in a
+//           block the caller owns and must free with delete[], and leaves
+//           *mat empty, as if just constructed. The heap block of the
+//           Matrix is handed over as is, after packing its rows in place
+//           if seams were removed; a new block is only allocated for a
+//           Matrix small enough to be stored inline.
+template <typename T>
+T* Matrix_release(Basic_matrix<T>* mat);
+
 #endif // MATRIX_H
@@ -1,6 +1,7 @@
 #include "Matrix_test_helpers.h"
 #include "unit_test_framework.h"
 #include <sstream>
+#include <climits>
 
 using namespace std;
 
@@ -280,10 +281,297 @@ TEST(test_matrix_min_value_in_row_basic){
   delete mat; // deletes the Matrix  
 }
 
+// Tests that a Matrix larger than the old 500x500 cap can be created and
+// that its corner elements are addressable.
+TEST(test_matrix_init_large){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  Matrix_init(mat, 4000, 3000);
+  Matrix_fill(mat, 7);
+  *Matrix_at(mat, 2999, 3999) = 9;
+
+  ASSERT_EQUAL(Matrix_width(mat), 4000);
+  ASSERT_EQUAL(Matrix_height(mat), 3000);
+  ASSERT_EQUAL(*Matrix_at(mat, 0, 0), 7);
+  ASSERT_EQUAL(Matrix_max(mat), 9);
+
+  delete mat; // deletes the Matrix
+}
+
+// Tests that copies of small (inline) and large (heap) matrices are
+// independent of the original.
+TEST(test_matrix_copy_independent){
+  Matrix *small = new Matrix; // creates a Matrix in dynamic memory
+  Matrix *large = new Matrix;
+
+  Matrix_init(small, 2, 2);
+  Matrix_fill(small, 1);
+  Matrix_init(large, 100, 100);
+  Matrix_fill(large, 2);
+
+  Matrix small_copy = *small;
+  Matrix large_copy = *large;
+  *Matrix_at(small, 0, 0) = 5;
+  *Matrix_at(large, 0, 0) = 5;
+
+  ASSERT_EQUAL(*Matrix_at(&small_copy, 0, 0), 1);
+  ASSERT_EQUAL(*Matrix_at(&large_copy, 0, 0), 2);
+
+  // Assigning a large Matrix over a small one and back again.
+  small_copy = large_copy;
+  ASSERT_TRUE(Matrix_equal(&small_copy, &large_copy));
+  large_copy = *small;
+  ASSERT_TRUE(Matrix_equal(&large_copy, small));
+
+  delete small; // deletes the Matrix
+  delete large;
+}
+
+// Removes a seam that touches the first, middle and last columns from a
+// 3x3 Matrix and checks the remaining elements shifted left in order.
+TEST(test_matrix_remove_vertical_seam_basic){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  Matrix_init(mat, 3, 3);
+  for (int r = 0; r < 3; ++r){
+    for (int c = 0; c < 3; ++c){
+      *Matrix_at(mat, r, c) = 10 * r + c;
+    }
+  }
+  const int seam[] = {0, 1, 2};
+  Matrix_remove_vertical_seam(mat, seam);
+
+  ASSERT_EQUAL(Matrix_width(mat), 2);
+  ASSERT_EQUAL(Matrix_height(mat), 3);
+  const int correct[] = {1, 2, 10, 12, 20, 21};
+  for (int r = 0; r < 3; ++r){
+    ASSERT_TRUE(array_equal(Matrix_at(mat, r, 0), correct + 2 * r, 2));
+  }
+
+  // A copy of the narrowed Matrix is packed and equal to it.
+  Matrix copy = *mat;
+  ASSERT_TRUE(Matrix_equal(&copy, mat));
+  ASSERT_TRUE(array_equal(copy.data, correct, 6));
+
+  delete mat; // deletes the Matrix
+}
+
+// Removes a horizontal seam that touches the first and last rows from a
+// 3x3 Matrix and checks the elements below it moved up.
+TEST(test_matrix_remove_horizontal_seam_basic){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  Matrix_init(mat, 3, 3);
+  for (int r = 0; r < 3; ++r){
+    for (int c = 0; c < 3; ++c){
+      *Matrix_at(mat, r, c) = 10 * r + c;
+    }
+  }
+  const int seam[] = {0, 1, 2};
+  Matrix_remove_horizontal_seam(mat, seam);
+
+  ASSERT_EQUAL(Matrix_width(mat), 3);
+  ASSERT_EQUAL(Matrix_height(mat), 2);
+  const int correct[] = {10, 1, 2, 20, 21, 12};
+  for (int r = 0; r < 2; ++r){
+    ASSERT_TRUE(array_equal(Matrix_at(mat, r, 0), correct + 3 * r, 3));
+  }
+
+  delete mat; // deletes the Matrix
+}
+
+// Prints a Matrix whose text spans several output chunks and includes
+// values outside the 0-255 lookup table, and checks the output matches
+// formatting each element with operator<<.
+TEST(test_matrix_print_large){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  Matrix_init(mat, 300, 200);
+  for (int r = 0; r < Matrix_height(mat); ++r){
+    for (int c = 0; c < Matrix_width(mat); ++c){
+      *Matrix_at(mat, r, c) = (r * 7919 + c * 104729) % 100000 - 500;
+    }
+  }
+  *Matrix_at(mat, 0, 0) = INT_MIN;
+  *Matrix_at(mat, 199, 299) = INT_MAX;
+
+  ostringstream correct_output;
+  correct_output << 300 << " " << 200 << "\n";
+  for (int r = 0; r < Matrix_height(mat); ++r){
+    for (int c = 0; c < Matrix_width(mat); ++c){
+      correct_output << *Matrix_at(mat, r, c) << " ";
+    }
+    correct_output << "\n";
+  }
+  ostringstream ss_output;
+  Matrix_print(mat, ss_output);
+
+  ASSERT_TRUE(ss_output.str().size() > 2 * PRINT_CHUNK_SIZE);
+  ASSERT_EQUAL(ss_output.str(), correct_output.str());
+
+  delete mat; // deletes the Matrix
+}
+
  
 // You are encouraged to use any functions from Matrix_test_helpers.h as needed.
 
 
+TEST(test_matrix_remove_vertical_seams_basic){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  Matrix_init(mat, 5, 3);
+  for (int r = 0; r < 3; ++r){
+    for (int c = 0; c < 5; ++c){
+      *Matrix_at(mat, r, c) = 10 * r + c;
+    }
+  }
+  // Two seams, stored back to back. They only need to be disjoint in
+  // every row, in any order.
+  const int seams[] = {3, 2, 0,
+                       1, 1, 4};
+  Matrix_remove_vertical_seams(mat, seams, 2);
+
+  ASSERT_EQUAL(Matrix_width(mat), 3);
+  ASSERT_EQUAL(Matrix_height(mat), 3);
+  const int correct[] = {0, 2, 4, 10, 13, 14, 21, 22, 23};
+  for (int r = 0; r < 3; ++r){
+    ASSERT_TRUE(array_equal(Matrix_at(mat, r, 0), correct + 3 * r, 3));
+  }
+
+  delete mat; // deletes the Matrix
+}
+
+TEST(test_byte_matrix_basic){
+  Byte_matrix *mat = new Byte_matrix; // creates a Byte_matrix in dynamic memory
+
+  // The same int-based functions work on 8-bit elements.
+  Matrix_init(mat, 3, 2);
+  Matrix_fill(mat, 255);
+  *Matrix_at(mat, 1, 0) = 7;
+  ASSERT_EQUAL(sizeof(*Matrix_at(mat, 0, 0)), 1u);
+  ASSERT_EQUAL(Matrix_max(mat), 255);
+  ASSERT_EQUAL(Matrix_column_of_min_value_in_row(mat, 1, 0, 3), 0);
+
+  const int seam[] = {2, 0};
+  Matrix_remove_vertical_seam(mat, seam);
+  ostringstream actual;
+  Matrix_print(mat, actual);
+  ASSERT_EQUAL(actual.str(), "2 2\n255 255 \n255 255 \n");
+
+  delete mat; // deletes the Byte_matrix
+}
+
+TEST(test_matrix_adopt_release){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+
+  // Adopting a block uses it as is, and releasing hands it back packed.
+  int* data = new int[6]{1, 2, 3, 4, 5, 6};
+  Matrix_adopt(mat, data, 3, 2);
+  ASSERT_EQUAL(Matrix_at(mat, 1, 0), data + 3);
+  const int seam[] = {0, 2};
+  Matrix_remove_vertical_seam(mat, seam);
+  int* released = Matrix_release(mat);
+  ASSERT_EQUAL(released, data);
+  ASSERT_EQUAL(released[0], 2);
+  ASSERT_EQUAL(released[1], 3);
+  ASSERT_EQUAL(released[2], 4);
+  ASSERT_EQUAL(released[3], 5);
+  ASSERT_EQUAL(Matrix_width(mat), 0);
+  delete[] released;
+
+  // A Matrix stored inline is copied into a new block.
+  Matrix_init(mat, 2, 1);
+  Matrix_fill(mat, 9);
+  released = Matrix_release(mat);
+  ASSERT_EQUAL(released[0], 9);
+  ASSERT_EQUAL(released[1], 9);
+  delete[] released;
+
+  delete mat; // deletes the Matrix
+}
+
+TEST(test_matrix_row_span){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+  Matrix_init(mat, 4, 3);
+  for (int r = 0; r < 3; ++r){
+    Matrix_span<int> row = Matrix_row_span(mat, r);
+    ASSERT_EQUAL(row.length, 4);
+    ASSERT_EQUAL(row.data, Matrix_at(mat, r, 0));
+    for (int c = 0; c < row.length; ++c){
+      row[c] = 10 * r + c;
+    }
+  }
+
+  // Rows keep their stride after a seam is removed, and spans follow it.
+  const int seam[] = {0, 3, 1};
+  Matrix_remove_vertical_seam(mat, seam);
+  const Matrix* const_mat = mat;
+  int sum = 0;
+  for (int r = 0; r < 3; ++r){
+    Matrix_span<const int> row = Matrix_row_span(const_mat, r);
+    ASSERT_EQUAL(row.length, 3);
+    ASSERT_EQUAL(row.data, Matrix_at(const_mat, r, 0));
+    for (int value : row){
+      sum += value;
+    }
+  }
+  ASSERT_EQUAL(sum, (1 + 2 + 3) + (10 + 11 + 12) + (20 + 22 + 23));
+
+  delete mat; // deletes the Matrix
+}
+
+// Micro-benchmarks of the Matrix primitives the processing stages lean
+// on. They only run when this program is given -b.
+const int BENCHMARK_WIDTH = 512;
+const int BENCHMARK_HEIGHT = 384;
+
+BENCHMARK(benchmark_matrix_max){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+  Matrix_init(mat, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+  for (int r = 0; r < BENCHMARK_HEIGHT; ++r){
+    for (int c = 0; c < BENCHMARK_WIDTH; ++c){
+      *Matrix_at(mat, r, c) = (r * 31 + c * 17) % 1000;
+    }
+  }
+
+  while (state.keep_running()){
+    do_not_optimize(Matrix_max(mat));
+  }
+
+  delete mat; // deletes the Matrix
+}
+
+BENCHMARK(benchmark_matrix_fill_border){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+  Matrix_init(mat, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+
+  int value = 0;
+  while (state.keep_running()){
+    Matrix_fill_border(mat, ++value);
+    do_not_optimize(*mat);
+  }
+
+  delete mat; // deletes the Matrix
+}
+
+BENCHMARK(benchmark_matrix_column_of_min_value_in_row){
+  Matrix *mat = new Matrix; // creates a Matrix in dynamic memory
+  Matrix_init(mat, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+  for (int r = 0; r < BENCHMARK_HEIGHT; ++r){
+    for (int c = 0; c < BENCHMARK_WIDTH; ++c){
+      *Matrix_at(mat, r, c) = (r * 31 + c * 17) % 1000;
+    }
+  }
+
+  int r = 0;
+  while (state.keep_running()){
+    do_not_optimize(Matrix_column_of_min_value_in_row(mat, r, 0, BENCHMARK_WIDTH));
+    r = (r + 1) % BENCHMARK_HEIGHT;
+  }
+
+  delete mat; // deletes the Matrix
+}
+
 // NOTE: The unit test framework tutorial in Lab 2 originally
 // had a semicolon after TEST_MAIN(). Although including and
 // excluding the semicolon are both correct according to the c++
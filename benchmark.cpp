@@ -0,0 +1,429 @@
+#include "Matrix.h"
+#include "Image.h"
+#include "processing.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// Fixture images timed when no file is given, looked up in the current
+// directory. Missing ones are skipped.
+const char* const FIXTURES[] = {"dog.ppm", "crabster.ppm", "horses.ppm"};
+
+// Number of seams removed in each dimension by the seam_carve stage.
+const int BENCHMARK_SEAMS = 32;
+
+// The timings of one stage on one image.
+struct Stage_result {
+    string image;
+    int width;
+    int height;
+    string layout;
+    string stage;
+    double median_ms;
+    double p95_ms;
+    double pixels_per_second;
+};
+
+static void print_usage(){
+    cout << "Usage: benchmark.exe [--repeats N] [--size WIDTHxHEIGHT]... [--layout planar|interleaved|both]\n"
+    << "                     [--output FILENAME] [--compare BASELINE [--threshold PERCENT]] [IN_FILENAME...]\n"
+    << "Times each processing stage on each image and prints the median and\n"
+    << "95th percentile time, in ms, and the throughput, in pixels per second.\n"
+    << "The images are the given files, or else the dog, crabster and horses\n"
+    << "fixtures found in the current directory, plus synthetic images.\n"
+    << "--repeats sets how many times each stage runs (11 by default)\n"
+    << "--size adds a synthetic image of that size; it can be repeated\n"
+    << "  (1024x768 and 2048x1536 by default)\n"
+    << "--layout selects the pixel layouts timed (both by default)\n"
+    << "--output sets the file the results are written to, as JSON\n"
+    << "  (bench_output.txt by default)\n"
+    << "--compare reads the results of an earlier run from BASELINE and flags\n"
+    << "  every stage whose median got slower by more than the threshold\n"
+    << "  (10 percent by default); the exit status is then 2" << endl;
+}
+
+// MODIFIES: *img
+// EFFECTS:  Fills img with a smooth pattern that has some structure for
+//           the seams to follow.
+static void fill_synthetic(Image* img){
+    for (int r = 0; r < Image_height(img); ++r){
+        for (int c = 0; c < Image_width(img); ++c){
+            Pixel color = {(r * 3 + c) % 256, (r * c / 7) % 256, (c * 5 + r / 3) % 256};
+            Image_set_pixel(img, r, c, color);
+        }
+    }
+}
+
+// REQUIRES: repeats >= 1
+// EFFECTS:  Runs setup and then stage repeats times, and returns the
+//           sorted times taken by stage, in milliseconds. setup is not
+//           timed.
+static vector<double> time_stage(int repeats, const function<void()>& setup,
+                                 const function<void()>& stage){
+    vector<double> times;
+    for (int i = 0; i < repeats; ++i){
+        setup();
+        const auto start = chrono::steady_clock::now();
+        stage();
+        const auto end = chrono::steady_clock::now();
+        times.push_back(chrono::duration<double, milli>(end - start).count());
+    }
+    sort(times.begin(), times.end());
+    return times;
+}
+
+// REQUIRES: times is sorted and not empty
+//           0 < fraction && fraction <= 1
+// EFFECTS:  Returns the smallest time that at least fraction of the times
+//           are less than or equal to.
+static double percentile(const vector<double>& times, double fraction){
+    const size_t rank = static_cast<size_t>(ceil(fraction * times.size()));
+    return times[max<size_t>(rank, 1) - 1];
+}
+
+// REQUIRES: source points to a valid Image at least 3 pixels wide and high
+// MODIFIES: results
+// EFFECTS:  Times every stage on source, converted to layout, and adds
+//           the results.
+static void benchmark_image(const string& name, const Image* source,
+                            Image_layout layout, int repeats,
+                            vector<Stage_result>& results){
+    const int width = Image_width(source);
+    const int height = Image_height(source);
+    Image *img = new Image; // create an Image in dynamic memory
+    Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+    Matrix *cost = new Matrix;
+    vector<int> seam(height);
+    *img = *source;
+    Image_set_layout(img, layout);
+    const Image original = *img;
+    auto reset = [&]{ *img = original; };
+
+    auto add = [&](const string& stage, const vector<double>& times){
+        const double median = percentile(times, 0.5);
+        results.push_back({name, width, height,
+                           layout == IMAGE_PLANAR ? "planar" : "interleaved", stage,
+                           median, percentile(times, 0.95),
+                           median > 0 ? width * static_cast<double>(height) / (median / 1000) : 0});
+    };
+
+    for (Ppm_format format : {PPM_PLAIN, PPM_BINARY}){
+        ostringstream os;
+        Image_print(img, os, format);
+        const string text = os.str();
+        const string suffix = format == PPM_PLAIN ? " p3" : " p6";
+        add("parse" + suffix, time_stage(repeats, []{}, [&]{
+            istringstream is(text);
+            Image_init(img, is, layout);
+        }));
+        add("print" + suffix, time_stage(repeats, []{}, [&]{
+            ostringstream out;
+            Image_print(&original, out, format);
+        }));
+    }
+
+    add("energy", time_stage(repeats, []{}, [&]{
+        compute_energy_matrix(img, energy);
+    }));
+    add("cost", time_stage(repeats, []{}, [&]{
+        compute_vertical_cost_matrix(energy, cost);
+    }));
+    int border_energy = *Matrix_at(energy, 0, 0);
+    add("energy+cost fused", time_stage(repeats, []{}, [&]{
+        compute_energy_and_cost_matrices(img, nullptr, cost, &border_energy);
+    }));
+    add("find seam", time_stage(repeats, []{}, [&]{
+        find_minimal_vertical_seam(cost, seam.data());
+    }));
+    add("remove seam", time_stage(repeats, reset, [&]{
+        remove_vertical_seam(img, seam.data());
+    }));
+    reset();
+    add("rotate left", time_stage(repeats, reset, [&]{
+        rotate_left(img);
+    }));
+    add("rotate right", time_stage(repeats, reset, [&]{
+        rotate_right(img);
+    }));
+    const int new_width = max(width - BENCHMARK_SEAMS, 1);
+    const int new_height = max(height - BENCHMARK_SEAMS, 1);
+    add("seam carve", time_stage(repeats, reset, [&]{
+        seam_carve(img, new_width, new_height);
+    }));
+
+    delete img; // delete the Image
+    delete energy; // delete the Matrix
+    delete cost;
+}
+
+// EFFECTS: Prints results as a table.
+static void print_results(const vector<Stage_result>& results){
+    cout << left << setw(24) << "image" << setw(13) << "layout" << setw(19) << "stage"
+    << right << setw(12) << "median ms" << setw(12) << "p95 ms" << setw(14) << "Mpixels/s"
+    << "\n" << fixed << setprecision(3);
+    for (const Stage_result& result : results){
+        ostringstream image;
+        image << result.image << " " << result.width << "x" << result.height;
+        cout << left << setw(24) << image.str() << setw(13) << result.layout
+        << setw(19) << result.stage << right << setw(12) << result.median_ms
+        << setw(12) << result.p95_ms << setw(14) << result.pixels_per_second / 1e6 << "\n";
+    }
+    cout.unsetf(ios::floatfield);
+    cout << flush;
+}
+
+// EFFECTS: Returns text as a JSON string literal.
+static string json_string(const string& text){
+    string quoted = "\"";
+    for (char c : text){
+        if (c == '"' || c == '\\'){
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// MODIFIES: os
+// EFFECTS:  Writes results to os as JSON: an object whose "results" array
+//           holds one object per stage, each on a line of its own.
+static void write_json(const vector<Stage_result>& results, int repeats, ostream& os){
+    os << "{\n  \"repeats\": " << repeats << ",\n  \"results\": [\n" << setprecision(9);
+    for (size_t i = 0; i < results.size(); ++i){
+        const Stage_result& result = results[i];
+        os << "    {\"image\": " << json_string(result.image)
+        << ", \"width\": " << result.width << ", \"height\": " << result.height
+        << ", \"layout\": " << json_string(result.layout)
+        << ", \"stage\": " << json_string(result.stage)
+        << ", \"median_ms\": " << result.median_ms << ", \"p95_ms\": " << result.p95_ms
+        << ", \"pixels_per_second\": " << result.pixels_per_second << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n}" << endl;
+}
+
+// EFFECTS: Returns the text of the field with the given name in a line
+//          written by write_json, without quotes, or "" if it is missing.
+static string json_field(const string& line, const string& name){
+    const string key = "\"" + name + "\": ";
+    size_t start = line.find(key);
+    if (start == string::npos){
+        return "";
+    }
+    start += key.size();
+    if (line[start] == '"'){
+        string value;
+        for (size_t i = start + 1; i < line.size() && line[i] != '"'; ++i){
+            if (line[i] == '\\' && i + 1 < line.size()){
+                ++i;
+            }
+            value += line[i];
+        }
+        return value;
+    }
+    const size_t end = line.find_first_of(",}", start);
+    return line.substr(start, end - start);
+}
+
+// EFFECTS: Returns the key that identifies a result from run to run.
+static string result_key(const string& image, const string& width,
+                         const string& height, const string& layout,
+                         const string& stage){
+    return image + " " + width + "x" + height + " " + layout + " " + stage;
+}
+
+// MODIFIES: baseline
+// EFFECTS:  Reads the median times of the results in is, written by
+//           write_json, into baseline by result_key. Returns false if is
+//           holds no results.
+static bool read_baseline(istream& is, map<string, double>& baseline){
+    string line;
+    while (getline(is, line)){
+        const string stage = json_field(line, "stage");
+        if (stage.empty()){
+            continue;
+        }
+        baseline[result_key(json_field(line, "image"), json_field(line, "width"),
+                            json_field(line, "height"), json_field(line, "layout"),
+                            stage)] = atof(json_field(line, "median_ms").c_str());
+    }
+    return !baseline.empty();
+}
+
+// EFFECTS: Prints how the median of each result compares to baseline, and
+//          returns the number of results more than threshold percent
+//          slower.
+static int compare_results(const vector<Stage_result>& results,
+                           const map<string, double>& baseline, double threshold){
+    int regressions = 0;
+    cout << "\n" << left << setw(56) << "compared to baseline" << right
+    << setw(12) << "baseline" << setw(12) << "now" << setw(10) << "change" << "\n"
+    << fixed << setprecision(3);
+    for (const Stage_result& result : results){
+        const string key = result_key(result.image, to_string(result.width),
+                                      to_string(result.height), result.layout,
+                                      result.stage);
+        const auto found = baseline.find(key);
+        if (found == baseline.end() || found->second <= 0){
+            continue;
+        }
+        const double change = (result.median_ms / found->second - 1) * 100;
+        cout << left << setw(56) << key << right << setw(12) << found->second
+        << setw(12) << result.median_ms << setw(9) << showpos << change << noshowpos << "%";
+        if (change > threshold){
+            cout << "  REGRESSION";
+            ++regressions;
+        }
+        cout << "\n";
+    }
+    cout.unsetf(ios::floatfield);
+    cout << regressions << " regression(s) over " << threshold << "%" << endl;
+    return regressions;
+}
+
+// EFFECTS: Parses a WIDTHxHEIGHT size. Returns false if it is malformed
+//          or smaller than 3x3.
+static bool parse_size(const string& size, int& width, int& height){
+    const size_t x = size.find('x');
+    if (x == string::npos){
+        return false;
+    }
+    width = atoi(size.substr(0, x).c_str());
+    height = atoi(size.substr(x + 1).c_str());
+    return width >= 3 && height >= 3;
+}
+
+int main(int argc, char *argv[]){
+    int repeats = 11;
+    vector<pair<int, int>> sizes;
+    vector<Image_layout> layouts = {IMAGE_PLANAR, IMAGE_INTERLEAVED};
+    string output = "bench_output.txt";
+    string baseline_filename;
+    double threshold = 10;
+    vector<string> filenames;
+    for (int i = 1; i < argc; ++i){
+        string arg = argv[i];
+        if (arg == "--repeats" && i + 1 < argc){
+            repeats = atoi(argv[++i]);
+            if (repeats < 1){
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--size" && i + 1 < argc){
+            int width, height;
+            if (!parse_size(argv[++i], width, height)){
+                print_usage();
+                return 1;
+            }
+            sizes.push_back({width, height});
+        }else if (arg == "--layout" && i + 1 < argc){
+            string layout = argv[++i];
+            if (layout == "planar"){
+                layouts = {IMAGE_PLANAR};
+            }else if (layout == "interleaved"){
+                layouts = {IMAGE_INTERLEAVED};
+            }else if (layout != "both"){
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--output" && i + 1 < argc){
+            output = argv[++i];
+        }else if (arg == "--compare" && i + 1 < argc){
+            baseline_filename = argv[++i];
+        }else if (arg == "--threshold" && i + 1 < argc){
+            threshold = atof(argv[++i]);
+            if (threshold < 0){
+                print_usage();
+                return 1;
+            }
+        }else if (arg[0] == '-'){
+            print_usage();
+            return 1;
+        }else{
+            filenames.push_back(arg);
+        }
+    }
+
+    // The baseline is read first, so a missing one is reported before the
+    // benchmark runs (and before output, which may be the same file, is
+    // overwritten).
+    map<string, double> baseline;
+    if (!baseline_filename.empty()){
+        ifstream fin(baseline_filename);
+        if (!fin.is_open() || !read_baseline(fin, baseline)){
+            cout << "Error reading baseline: " << baseline_filename << endl;
+            return 1;
+        }
+    }
+
+    bool use_fixtures = filenames.empty();
+    if (use_fixtures){
+        filenames.assign(begin(FIXTURES), end(FIXTURES));
+        if (sizes.empty()){
+            sizes = {{1024, 768}, {2048, 1536}};
+        }
+    }
+
+    vector<Stage_result> results;
+    Image *img = new Image; // create an Image in dynamic memory
+    for (const string& filename : filenames){
+        try {
+            if (!Image_init_from_file(img, filename)) {
+                if (use_fixtures){
+                    cout << "Skipping " << filename << ": not found" << endl;
+                    continue;
+                }
+                cout << "Error opening file: " << filename << endl;
+                return 1;
+            }
+        }
+        catch (Ppm_error& error) {
+            cout << "Error reading file: " << filename << ": "
+            << error.what() << endl;
+            return 1;
+        }
+        if (Image_width(img) < 3 || Image_height(img) < 3){
+            cout << "Skipping " << filename << ": too small" << endl;
+            continue;
+        }
+        string name = filename.substr(filename.find_last_of("/\\") + 1);
+        name = name.substr(0, name.rfind(".ppm"));
+        for (Image_layout layout : layouts){
+            benchmark_image(name, img, layout, repeats, results);
+        }
+    }
+    for (const auto& size : sizes){
+        Image_init(img, size.first, size.second);
+        fill_synthetic(img);
+        for (Image_layout layout : layouts){
+            benchmark_image("synthetic", img, layout, repeats, results);
+        }
+    }
+    delete img; // delete the Image
+
+    print_results(results);
+    ofstream fout(output);
+    if (!fout.is_open()){
+        cout << "Error opening file: " << output << endl;
+        return 1;
+    }
+    write_json(results, repeats, fout);
+    cout << "Wrote " << output << endl;
+
+    if (!baseline_filename.empty() && compare_results(results, baseline, threshold) > 0){
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,272 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+// Lightweight per-stage timers and counters for the resize pipeline.
+//
+// Build with -DINSTRUMENTATION=0 to compile the INSTRUMENT_ macros out
+// completely. Otherwise they are compiled in, but record nothing until
+// Instrumentation_start is called, so an idle timer costs one branch.
+//
+// The records are kept per thread: they cover the stages the calling
+// thread runs, which includes the time spent waiting on the thread pool.
+
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION 1
+#endif
+
+// The stages of the pipeline that are timed. STAGE_CARVE_WIDTH and
+// STAGE_CARVE_HEIGHT contain the energy, DP, backtrack and removal stages
+// they run. STAGE_ENERGY_DP is the fused energy and cost pass.
+// STAGE_SEAM_CACHE is a Seam_cache lookup, which contains the reading or
+// writing of the record (STAGE_ORDER_IO) and, on a miss, the carve.
+enum Instrument_stage {
+  STAGE_PARSE,
+  STAGE_PRINT,
+  STAGE_CARVE_WIDTH,
+  STAGE_CARVE_HEIGHT,
+  STAGE_ENERGY,
+  STAGE_DP,
+  STAGE_ENERGY_DP,
+  STAGE_BACKTRACK,
+  STAGE_REMOVAL,
+  STAGE_ROTATION,
+  STAGE_SEAM_CACHE,
+  STAGE_ORDER_IO,
+  NUM_STAGES
+};
+
+// The counters. COUNTER_PIXELS_TOUCHED adds up the pixels each timed
+// stage covers. Only the innermost stages cover pixels (carve_width,
+// carve_height and seam_cache cover none) and they never nest in each other, so no
+// pixel is counted twice for one run. COUNTER_ALLOCATIONS counts the
+// times image or scratch storage had to be allocated or grown.
+enum Instrument_counter {
+  COUNTER_SEAMS_REMOVED,
+  COUNTER_PIXELS_TOUCHED,
+  COUNTER_ALLOCATIONS,
+  NUM_COUNTERS
+};
+
+const char* const INSTRUMENT_STAGE_NAMES[NUM_STAGES] = {
+  "parse", "print", "carve_width", "carve_height", "energy", "dp",
+  "energy_dp", "backtrack", "removal", "rotation",
+  "seam_cache", "order_io"
+};
+
+const char* const INSTRUMENT_COUNTER_NAMES[NUM_COUNTERS] = {
+  "seams_removed", "pixels_touched", "allocations"
+};
+
+// One timed run of a stage, in microseconds since Instrumentation_start.
+struct Instrument_event {
+  Instrument_stage stage;
+  double start_us;
+  double duration_us;
+};
+
+struct Instrumentation {
+  using Clock = std::chrono::steady_clock;
+
+  bool enabled = false;
+  bool tracing = false;
+  bool in_pixel_stage = false;  // a stage that covers pixels is running
+  Clock::time_point origin{};
+  double stage_us[NUM_STAGES] = {};
+  long long stage_calls[NUM_STAGES] = {};
+  long long stage_pixels[NUM_STAGES] = {};
+  long long counters[NUM_COUNTERS] = {};
+  std::vector<Instrument_event> events;
+};
+
+// EFFECTS: Returns the records of the calling thread.
+inline Instrumentation* Instrumentation_get() {
+  static thread_local Instrumentation instrumentation;
+  return &instrumentation;
+}
+
+// MODIFIES: the records of the calling thread
+// EFFECTS:  Clears the records and starts recording. If trace is true,
+//           every timed run is also kept as an event for
+//           Instrumentation_print_trace.
+inline void Instrumentation_start(bool trace) {
+  Instrumentation* inst = Instrumentation_get();
+  *inst = Instrumentation();
+  inst->enabled = true;
+  inst->tracing = trace;
+  inst->origin = Instrumentation::Clock::now();
+}
+
+// MODIFIES: the records of the calling thread
+// EFFECTS:  Stops recording, keeping what was recorded.
+inline void Instrumentation_stop() {
+  Instrumentation_get()->enabled = false;
+}
+
+// MODIFIES: the records of the calling thread
+// EFFECTS:  Adds amount to counter, if recording.
+inline void Instrumentation_count(Instrument_counter counter, long long amount) {
+  Instrumentation* inst = Instrumentation_get();
+  if (inst->enabled) {
+    inst->counters[counter] += amount;
+  }
+}
+
+// Times the scope it lives in as one run of a stage that covers the
+// given number of pixels. Use it through INSTRUMENT_SCOPE.
+class Instrument_timer {
+public:
+  Instrument_timer(Instrument_stage stage_, long long pixels_)
+      : inst(Instrumentation_get()), stage(stage_), pixels(pixels_),
+        active(inst->enabled) {
+    if (active) {
+      if (covers_pixels()) {
+        assert(!inst->in_pixel_stage && "stages that cover pixels can't nest");
+        inst->in_pixel_stage = true;
+      }
+      start = Instrumentation::Clock::now();
+    }
+  }
+
+  ~Instrument_timer() {
+    if (!active || !inst->enabled) {
+      return;
+    }
+    if (covers_pixels()) {
+      inst->in_pixel_stage = false;
+    }
+    const auto end = Instrumentation::Clock::now();
+    const double duration =
+        std::chrono::duration<double, std::micro>(end - start).count();
+    inst->stage_us[stage] += duration;
+    ++inst->stage_calls[stage];
+    inst->stage_pixels[stage] += pixels;
+    inst->counters[COUNTER_PIXELS_TOUCHED] += pixels;
+    if (inst->tracing) {
+      const double start_us =
+          std::chrono::duration<double, std::micro>(start - inst->origin).count();
+      inst->events.push_back({stage, start_us, duration});
+    }
+  }
+
+  // Sets the pixels the run covers, for a stage that only learns them
+  // once it has started.
+  void set_pixels(long long pixels_) {
+    pixels = pixels_;
+  }
+
+  Instrument_timer(const Instrument_timer&) = delete;
+  Instrument_timer& operator=(const Instrument_timer&) = delete;
+
+private:
+  // EFFECTS: Returns whether the stage covers pixels: all but the carve
+  //          and cache stages, which only contain others.
+  bool covers_pixels() const {
+    return stage != STAGE_CARVE_WIDTH && stage != STAGE_CARVE_HEIGHT &&
+           stage != STAGE_SEAM_CACHE;
+  }
+
+  Instrumentation* inst;
+  Instrument_stage stage;
+  long long pixels;
+  bool active;
+  Instrumentation::Clock::time_point start{};
+};
+
+#if INSTRUMENTATION
+// Times the rest of the enclosing scope as one run of stage, covering
+// pixels pixels. There can be one per scope.
+#define INSTRUMENT_SCOPE(stage, pixels)                                     \
+  Instrument_timer instrument_scope((stage), (pixels))
+// Sets the pixels covered by the INSTRUMENT_SCOPE of the enclosing scope.
+#define INSTRUMENT_SCOPE_PIXELS(pixels) instrument_scope.set_pixels(pixels)
+// Adds amount to counter.
+#define INSTRUMENT_COUNT(counter, amount) Instrumentation_count((counter), (amount))
+#else
+#define INSTRUMENT_SCOPE(stage, pixels) static_cast<void>(0)
+#define INSTRUMENT_SCOPE_PIXELS(pixels) static_cast<void>(0)
+#define INSTRUMENT_COUNT(counter, amount) static_cast<void>(0)
+#endif
+
+// MODIFIES: os
+// EFFECTS:  Prints the time, runs and pixels of each stage that ran, and
+//           the counters, as a table.
+inline void Instrumentation_print_text(std::ostream& os) {
+  const Instrumentation* inst = Instrumentation_get();
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3) << std::left << std::setw(16)
+      << "stage" << std::right << std::setw(12) << "total ms"
+      << std::setw(10) << "runs" << std::setw(14) << "pixels"
+      << std::setw(12) << "Mpixels/s" << "\n";
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    if (inst->stage_calls[s] == 0) {
+      continue;
+    }
+    const double us = inst->stage_us[s];
+    out << std::left << std::setw(16) << INSTRUMENT_STAGE_NAMES[s]
+        << std::right << std::setw(12) << us / 1000
+        << std::setw(10) << inst->stage_calls[s]
+        << std::setw(14) << inst->stage_pixels[s]
+        << std::setw(12) << (us > 0 ? inst->stage_pixels[s] / us : 0) << "\n";
+  }
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    out << std::left << std::setw(16) << INSTRUMENT_COUNTER_NAMES[c]
+        << std::right << std::setw(12) << inst->counters[c] << "\n";
+  }
+  os << out.str();
+}
+
+// MODIFIES: os
+// EFFECTS:  Prints the same numbers as Instrumentation_print_text as a
+//           JSON object.
+inline void Instrumentation_print_json(std::ostream& os) {
+  const Instrumentation* inst = Instrumentation_get();
+  std::ostringstream out;
+  out << std::setprecision(12) << "{\n  \"stages\": {";
+  const char* separator = "\n";
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    if (inst->stage_calls[s] == 0) {
+      continue;
+    }
+    out << separator << "    \"" << INSTRUMENT_STAGE_NAMES[s]
+        << "\": {\"total_ms\": " << inst->stage_us[s] / 1000
+        << ", \"runs\": " << inst->stage_calls[s]
+        << ", \"pixels\": " << inst->stage_pixels[s] << "}";
+    separator = ",\n";
+  }
+  out << "\n  },\n  \"counters\": {";
+  separator = "\n";
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    out << separator << "    \"" << INSTRUMENT_COUNTER_NAMES[c]
+        << "\": " << inst->counters[c];
+    separator = ",\n";
+  }
+  out << "\n  }\n}\n";
+  os << out.str();
+}
+
+// MODIFIES: os
+// EFFECTS:  Prints the events recorded with tracing on in the Chrome
+//           trace event format, which chrome://tracing and Perfetto show
+//           as a flame timeline.
+inline void Instrumentation_print_trace(std::ostream& os) {
+  const Instrumentation* inst = Instrumentation_get();
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+  const char* separator = "\n";
+  for (const Instrument_event& event : inst->events) {
+    out << separator << "  {\"name\": \"" << INSTRUMENT_STAGE_NAMES[event.stage]
+        << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " << event.start_us
+        << ", \"dur\": " << event.duration_us << "}";
+    separator = ",\n";
+  }
+  out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  os << out.str();
+}
+
+#endif // INSTRUMENTATION_H
@@ -1,225 +1,1946 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "instrumentation.h"
 #include "processing.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
 using namespace std;
 
 // v DO NOT CHANGE v ------------------------------------------------
-// The implementation of rotate_left is provided for you.
+// The implementation of diff2 is provided for you.
+static int squared_difference(Pixel p1, Pixel p2) {
+  int dr = p2.r - p1.r;
+  int dg = p2.g - p1.g;
+  int db = p2.b - p1.b;
+  // Divide by 100 is to avoid possible overflows
+  // later on in the algorithm.
+  return (dr*dr + dg*dg + db*db) / 100;
+}
+// ^ DO NOT CHANGE ^ ------------------------------------------------
+
+
+// ------------------------------------------------------------------
+// You may change code below this line!
+
 // REQUIRES: img points to a valid Image
-// MODIFIES: *img
-// EFFECTS:  The image is rotated 90 degrees to the left (counterclockwise).
-void rotate_left(Image* img) {
+//           0 <= r && r < Image_height(img)
+//           0 <= c && c < Image_width(img)
+// EFFECTS:  Returns the pixel at row r, column c, like Image_get_pixel,
+//           read through the row spans so it inlines (which is also why
+//           it reads img->layout rather than calling Image_get_layout).
+static inline Pixel pixel_at(const Image* img, int r, int c) {
+  if (img->layout == IMAGE_INTERLEAVED) {
+    const Byte_rgb color = Image_pixel_row(img, r)[c];
+    return Pixel{color.r, color.g, color.b};
+  }
+  return Pixel{Image_channel_row(img, IMAGE_RED, r)[c],
+               Image_channel_row(img, IMAGE_GREEN, r)[c],
+               Image_channel_row(img, IMAGE_BLUE, r)[c]};
+}
 
-  // for convenience
-  int width = Image_width(img);
-  int height = Image_height(img);
+// REQUIRES: img points to a valid Image
+//           0 < r && r < Image_height(img) - 1
+//           0 < c && c < Image_width(img) - 1
+// EFFECTS:  Returns the energy of the non-border pixel at row r, column c.
+static int pixel_energy(const Image* img, int r, int c) {
+  int ns_diff = squared_difference(pixel_at(img, r -  1, c), pixel_at(img, r + 1, c));
+  int we_diff = squared_difference(pixel_at(img, r, c - 1), pixel_at(img, r, c + 1));
+  return ns_diff + we_diff;
+}
 
-  // auxiliary image to temporarily store rotated image
-  Image *aux = new Image;
-  Image_init(aux, height, width); // width and height switched
 
-  // iterate through pixels and place each where it goes in temp
-  for (int r = 0; r < height; ++r) {
+// ------------------------------------------------------------------
+// Thread pool shared by the processing functions.
+//
+// The worker threads are started by set_num_threads and then sleep
+// between jobs, so every seam reuses them instead of spawning threads.
+
+class Thread_pool {
+public:
+  // REQUIRES: num_workers >= 0
+  // EFFECTS:  Starts num_workers worker threads.
+  explicit Thread_pool(int num_workers) {
+    for (int i = 0; i < num_workers; ++i) {
+      workers.emplace_back(&Thread_pool::work, this);
+    }
+  }
+
+  // EFFECTS: Stops and joins the worker threads.
+  ~Thread_pool() {
+    {
+      lock_guard<mutex> lock(jobs_mutex);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    for (thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  Thread_pool(const Thread_pool&) = delete;
+  Thread_pool& operator=(const Thread_pool&) = delete;
+
+  // REQUIRES: num_tasks >= 0
+  //           run is not called concurrently
+  // EFFECTS:  Calls task(i) for each i in [0, num_tasks), spread over the
+  //           workers and the calling thread, and returns once all calls
+  //           have returned.
+  void run(int num_tasks, const function<void(int)>& task) {
+    {
+      lock_guard<mutex> lock(jobs_mutex);
+      job = &task;
+      job_size = num_tasks;
+      next_task = 0;
+      unfinished_tasks = num_tasks;
+    }
+    job_ready.notify_all();
+    run_tasks();
+    unique_lock<mutex> lock(jobs_mutex);
+    job_done.wait(lock, [this] { return unfinished_tasks == 0; });
+    job = nullptr;
+  }
+
+private:
+  // EFFECTS: Runs tasks of the current job until none are left.
+  void run_tasks() {
+    unique_lock<mutex> lock(jobs_mutex);
+    while (job && next_task < job_size) {
+      const int task = next_task++;
+      lock.unlock();
+      (*job)(task);
+      lock.lock();
+      if (--unfinished_tasks == 0) {
+        job_done.notify_all();
+      }
+    }
+  }
+
+  // EFFECTS: Worker thread loop: waits for jobs and helps run them.
+  void work() {
+    while (true) {
+      {
+        unique_lock<mutex> lock(jobs_mutex);
+        job_ready.wait(lock, [this] {
+          return stopping || (job && next_task < job_size);
+        });
+        if (stopping) {
+          return;
+        }
+      }
+      run_tasks();
+    }
+  }
+
+  vector<thread> workers;
+  mutex jobs_mutex;
+  condition_variable job_ready;
+  condition_variable job_done;
+  const function<void(int)>* job = nullptr;
+  int job_size = 0;
+  int next_task = 0;
+  int unfinished_tasks = 0;
+  bool stopping = false;
+};
+
+static int current_num_threads = 1;
+static unique_ptr<Thread_pool> thread_pool;
+
+// REQUIRES: num_threads >= 1
+//           no processing function is running
+// MODIFIES: the threads used by the processing functions
+// EFFECTS:  Makes the processing functions use num_threads threads.
+void set_num_threads(int num_threads) {
+  assert(num_threads >= 1);
+  if (num_threads == current_num_threads) {
+    return;
+  }
+  thread_pool.reset();
+  if (num_threads > 1) {
+    // the calling thread is one of the num_threads
+    thread_pool.reset(new Thread_pool(num_threads - 1));
+  }
+  current_num_threads = num_threads;
+}
+
+// EFFECTS: Returns the number of threads used by the processing functions.
+int get_num_threads() {
+  return current_num_threads;
+}
+
+// EFFECTS: Returns how many bands to split num_items rows (or columns)
+//          into.
+static int num_bands(int num_items) {
+  return max(1, min(current_num_threads, num_items));
+}
+
+// REQUIRES: start <= end
+//           bands >= 1
+// EFFECTS:  Splits the rows (or columns) [start, end) into bands
+//           consecutive bands of (nearly) equal size and calls
+//           body(band, band_start, band_end) for each, on the thread pool.
+// NOTE:     Nothing is allocated: the job handed to the pool only captures
+//           a reference, which std::function stores inline.
+template <typename Body>
+static void for_each_band(int start, int end, int bands, const Body& body) {
+  const int num_items = end - start;
+  auto task = [&](int band) {
+    body(band, start + static_cast<int>(static_cast<long long>(num_items) * band / bands),
+         start + static_cast<int>(static_cast<long long>(num_items) * (band + 1) / bands));
+  };
+  if (bands == 1 || !thread_pool) {
+    for (int band = 0; band < bands; ++band) {
+      task(band);
+    }
+  } else {
+    const function<void(int)> job = [&task](int band) { task(band); };
+    thread_pool->run(bands, job);
+  }
+}
+
+
+// ------------------------------------------------------------------
+// Vectorized kernels and runtime instruction set dispatch.
+//
+// Each kernel has a scalar version and, on x86, SSE2 and AVX2 versions.
+// The AVX2 versions are compiled with a function-level target attribute,
+// so no special compiler flags are needed, and are only called after the
+// CPU has been checked for AVX2 support. All versions give identical
+// results.
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PROCESSING_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// EFFECTS: Returns the most capable Simd_level this CPU supports.
+Simd_level simd_level_supported() {
+#ifdef PROCESSING_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SIMD_SSE2;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+static Simd_level current_simd_level = simd_level_supported();
+
+// REQUIRES: level <= simd_level_supported()
+// MODIFIES: the instruction set used by the processing kernels
+// EFFECTS:  Makes the processing kernels use the given instruction set.
+void set_simd_level(Simd_level level) {
+  assert(level <= simd_level_supported());
+  current_simd_level = level;
+}
+
+// EFFECTS: Returns the instruction set used by the processing kernels.
+Simd_level get_simd_level() {
+  return current_simd_level;
+}
+
+// The rows of the three channels of an Image around an image row.
+struct Energy_rows {
+  const uint8_t* above[3];
+  const uint8_t* row[3];
+  const uint8_t* below[3];
+};
+
+// REQUIRES: img points to a valid IMAGE_PLANAR Image
+//           0 < r && r < Image_height(img) - 1
+// EFFECTS:  Returns the channel rows needed for the energies of row r.
+static Energy_rows energy_rows(const Image* img, int r) {
+  Energy_rows rows;
+  for (int i = 0; i < 3; ++i) {
+    const Image_channel channel = static_cast<Image_channel>(i);
+    rows.above[i] = Image_channel_row(img, channel, r - 1).data;
+    rows.row[i] = Image_channel_row(img, channel, r).data;
+    rows.below[i] = Image_channel_row(img, channel, r + 1).data;
+  }
+  return rows;
+}
+
+// A rolling window of three rows of an IMAGE_INTERLEAVED Image, split
+// into planar rows so the energy kernels can read them like channel rows.
+// Image row r is kept in slot r % 3.
+struct Planar_window {
+  int width;
+  uint8_t* bytes;  // 3 slots of 3 channel rows of width bytes, not owned
+};
+
+// Bytes of scratch space a Planar_window needs for rows of the given width.
+static size_t Planar_window_size(int width) {
+  return 9 * static_cast<size_t>(width);
+}
+
+// REQUIRES: img points to a valid IMAGE_INTERLEAVED Image
+//           bytes points to Planar_window_size(Image_width(img)) bytes
+// MODIFIES: *window
+// EFFECTS:  Initializes the window, empty, for rows of img, kept in bytes.
+static void Planar_window_init(Planar_window* window, const Image* img,
+                               uint8_t* bytes) {
+  window->width = Image_width(img);
+  window->bytes = bytes;
+}
+
+// REQUIRES: window was initialized for img
+//           0 <= r && r < Image_height(img)
+// MODIFIES: *window
+// EFFECTS:  Splits image row r into the window, replacing row r - 3.
+static void Planar_window_load(Planar_window* window, const Image* img, int r) {
+  const int width = window->width;
+  uint8_t* red = window->bytes + (r % 3) * 3 * width;
+  uint8_t* green = red + width;
+  uint8_t* blue = green + width;
+  const Matrix_span<const Byte_rgb> row = Image_pixel_row(img, r);
+  for (int c = 0; c < width; ++c) {
+    red[c] = row[c].r;
+    green[c] = row[c].g;
+    blue[c] = row[c].b;
+  }
+}
+
+// REQUIRES: rows r - 1, r and r + 1 are loaded in window
+// EFFECTS:  Returns the channel rows needed for the energies of row r.
+static Energy_rows Planar_window_rows(const Planar_window* window, int r) {
+  const int width = window->width;
+  const uint8_t* slots[3] = {window->bytes + ((r - 1) % 3) * 3 * width,
+                             window->bytes + (r % 3) * 3 * width,
+                             window->bytes + ((r + 1) % 3) * 3 * width};
+  Energy_rows rows;
+  for (int i = 0; i < 3; ++i) {
+    rows.above[i] = slots[0] + i * width;
+    rows.row[i] = slots[1] + i * width;
+    rows.below[i] = slots[2] + i * width;
+  }
+  return rows;
+}
+
+// REQUIRES: rows holds the channel rows of a non-border image row
+//           out points to an array of width ints
+// MODIFIES: out[column_start]...out[width-2]
+// EFFECTS:  Writes the energy of each pixel from column_start to the last
+//           non-border column, and returns the largest one (or 0 if none).
+static int energy_row_scalar(const Energy_rows& rows, int* out, int width,
+                             int column_start) {
+  int max_energy = 0;
+  for (int c = column_start; c < width - 1; ++c) {
+    Pixel up = {rows.above[0][c], rows.above[1][c], rows.above[2][c]};
+    Pixel down = {rows.below[0][c], rows.below[1][c], rows.below[2][c]};
+    Pixel left = {rows.row[0][c - 1], rows.row[1][c - 1], rows.row[2][c - 1]};
+    Pixel right = {rows.row[0][c + 1], rows.row[1][c + 1], rows.row[2][c + 1]};
+    out[c] = squared_difference(up, down) + squared_difference(left, right);
+    max_energy = max(max_energy, out[c]);
+  }
+  return max_energy;
+}
+
+#ifdef PROCESSING_X86_SIMD
+
+// EFFECTS: Returns the low 32 bits of the products of the 32-bit lanes of
+//          a and b (SSE2 has no single instruction for this).
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b) {
+  const __m128i even = _mm_mul_epu32(a, b);
+  const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// EFFECTS: Returns each (unsigned) 32-bit lane of x divided by 100. Uses
+//          the multiply-by-reciprocal identity x / 100 == (x * 0x51EB851F)
+//          >> 37, which is exact for every 32-bit x, so it truncates just
+//          like the scalar integer division.
+static inline __m128i div100_epu32_sse2(__m128i x) {
+  const __m128i magic = _mm_set1_epi32(0x51EB851F);
+  const __m128i even = _mm_srli_epi64(_mm_mul_epu32(x, magic), 37);
+  const __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), magic), 37);
+  return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+// EFFECTS: Returns the lane-wise maximum of a and b.
+static inline __m128i max_epi32_sse2(__m128i a, __m128i b) {
+  const __m128i a_greater = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(a_greater, a), _mm_andnot_si128(a_greater, b));
+}
+
+// EFFECTS: Returns the 4 bytes at p widened to 32-bit lanes.
+static inline __m128i load_4_bytes_sse2(const uint8_t* p) {
+  int32_t bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}
+
+// EFFECTS: Returns the squared difference (as in squared_difference) of
+//          the pixels at p1 and p2 in each channel, for 4 columns.
+static inline __m128i squared_difference_sse2(const uint8_t* const p1[3], int c1,
+                                              const uint8_t* const p2[3], int c2) {
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < 3; ++i) {
+    const __m128i a = load_4_bytes_sse2(p1[i] + c1);
+    const __m128i b = load_4_bytes_sse2(p2[i] + c2);
+    const __m128i d = _mm_sub_epi32(b, a);
+    sum = _mm_add_epi32(sum, mullo_epi32_sse2(d, d));
+  }
+  return div100_epu32_sse2(sum);
+}
+
+// Same as energy_row_scalar, 4 columns at a time.
+static int energy_row_sse2(const Energy_rows& rows, int* out, int width,
+                           int column_start) {
+  __m128i max_energy = _mm_setzero_si128();
+  int c = column_start;
+  for (; c + 4 <= width - 1; c += 4) {
+    const __m128i ns = squared_difference_sse2(rows.above, c, rows.below, c);
+    const __m128i we = squared_difference_sse2(rows.row, c - 1, rows.row, c + 1);
+    const __m128i energy = _mm_add_epi32(ns, we);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), energy);
+    max_energy = max_epi32_sse2(max_energy, energy);
+  }
+  int lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), max_energy);
+  const int tail_max = energy_row_scalar(rows, out, width, c);
+  return max(max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3])), tail_max);
+}
+
+// EFFECTS: Same as div100_epu32_sse2, for 8 lanes.
+__attribute__((target("avx2")))
+static inline __m256i div100_epu32_avx2(__m256i x) {
+  const __m256i magic = _mm256_set1_epi32(0x51EB851F);
+  const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, magic), 37);
+  const __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), magic), 37);
+  return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+// EFFECTS: Returns the 8 bytes at p widened to 32-bit lanes.
+__attribute__((target("avx2")))
+static inline __m256i load_8_bytes_avx2(const uint8_t* p) {
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+// EFFECTS: Same as squared_difference_sse2, for 8 columns.
+__attribute__((target("avx2")))
+static inline __m256i squared_difference_avx2(const uint8_t* const p1[3], int c1,
+                                              const uint8_t* const p2[3], int c2) {
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = 0; i < 3; ++i) {
+    const __m256i a = load_8_bytes_avx2(p1[i] + c1);
+    const __m256i b = load_8_bytes_avx2(p2[i] + c2);
+    const __m256i d = _mm256_sub_epi32(b, a);
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(d, d));
+  }
+  return div100_epu32_avx2(sum);
+}
+
+// Same as energy_row_scalar, 8 columns at a time.
+__attribute__((target("avx2")))
+static int energy_row_avx2(const Energy_rows& rows, int* out, int width,
+                           int column_start) {
+  __m256i max_energy = _mm256_setzero_si256();
+  int c = column_start;
+  for (; c + 8 <= width - 1; c += 8) {
+    const __m256i ns = squared_difference_avx2(rows.above, c, rows.below, c);
+    const __m256i we = squared_difference_avx2(rows.row, c - 1, rows.row, c + 1);
+    const __m256i energy = _mm256_add_epi32(ns, we);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + c), energy);
+    max_energy = _mm256_max_epi32(max_energy, energy);
+  }
+  int lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), max_energy);
+  int row_max = energy_row_scalar(rows, out, width, c);
+  for (int lane : lanes) {
+    row_max = max(row_max, lane);
+  }
+  return row_max;
+}
+
+#endif // PROCESSING_X86_SIMD
+
+// REQUIRES: rows holds the channel rows of a non-border image row
+//           out points to an array of width ints
+// MODIFIES: out[1]...out[width-2]
+// EFFECTS:  Writes the energy of each non-border pixel in the row, using
+//           the current Simd_level, and returns the largest (or 0 if none).
+static int energy_row(const Energy_rows& rows, int* out, int width) {
+#ifdef PROCESSING_X86_SIMD
+  switch (current_simd_level) {
+  case SIMD_AVX2:
+    return energy_row_avx2(rows, out, width, 1);
+  case SIMD_SSE2:
+    return energy_row_sse2(rows, out, width, 1);
+  case SIMD_SCALAR:
+    break;
+  }
+#endif
+  return energy_row_scalar(rows, out, width, 1);
+}
+
+
+// REQUIRES: prev, energy and out point to arrays of width ints
+//           0 < column_start && column_end < width
+// MODIFIES: out[column_start]...out[column_end-1]
+// EFFECTS:  Writes the cost of each non-edge cell in [column_start,
+//           column_end): its energy plus the minimum of the three costs
+//           above it in prev.
+static void cost_row_scalar(const int* prev, const int* energy, int* out,
+                            int column_start, int column_end) {
+  for (int c = column_start; c < column_end; ++c) {
+    out[c] = energy[c] + min(prev[c - 1], min(prev[c], prev[c + 1]));
+  }
+}
+
+#ifdef PROCESSING_X86_SIMD
+
+// EFFECTS: Returns the lane-wise minimum of a and b.
+static inline __m128i min_epi32_sse2(__m128i a, __m128i b) {
+  const __m128i a_greater = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(a_greater, b), _mm_andnot_si128(a_greater, a));
+}
+
+// Same as cost_row_scalar, 4 columns at a time. The three neighbors
+// above are read as the prev row shifted by -1, 0 and +1 columns.
+static void cost_row_sse2(const int* prev, const int* energy, int* out,
+                          int column_start, int column_end) {
+  int c = column_start;
+  for (; c + 4 <= column_end; c += 4) {
+    const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + c - 1));
+    const __m128i middle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + c));
+    const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + c + 1));
+    const __m128i cell = _mm_loadu_si128(reinterpret_cast<const __m128i*>(energy + c));
+    const __m128i min_above = min_epi32_sse2(left, min_epi32_sse2(middle, right));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), _mm_add_epi32(cell, min_above));
+  }
+  cost_row_scalar(prev, energy, out, c, column_end);
+}
+
+// Same as cost_row_scalar, 8 columns at a time.
+__attribute__((target("avx2")))
+static void cost_row_avx2(const int* prev, const int* energy, int* out,
+                          int column_start, int column_end) {
+  int c = column_start;
+  for (; c + 8 <= column_end; c += 8) {
+    const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + c - 1));
+    const __m256i middle = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + c));
+    const __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + c + 1));
+    const __m256i cell = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(energy + c));
+    const __m256i min_above = _mm256_min_epi32(left, _mm256_min_epi32(middle, right));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + c), _mm256_add_epi32(cell, min_above));
+  }
+  cost_row_scalar(prev, energy, out, c, column_end);
+}
+
+#endif // PROCESSING_X86_SIMD
+
+// REQUIRES: prev, energy and out point to arrays of width ints
+//           0 <= column_start && column_end <= width
+// MODIFIES: out[column_start]...out[column_end-1]
+// EFFECTS:  Writes the columns [column_start, column_end) of one row of a
+//           vertical cost matrix, given the row of costs above it and the
+//           row's energies. The edge columns, which only have two
+//           neighbors above, are handled here and the rest by the kernel
+//           for the current Simd_level.
+static void cost_row(const int* prev, const int* energy, int* out, int width,
+                     int column_start, int column_end) {
+  if (column_start >= column_end) {
+    return;
+  }
+  if (width == 1) {
+    out[0] = energy[0] + prev[0];
+    return;
+  }
+  if (column_start == 0) {
+    out[0] = energy[0] + min(prev[0], prev[1]);
+    column_start = 1;
+  }
+  if (column_end == width) {
+    out[width - 1] = energy[width - 1] + min(prev[width - 2], prev[width - 1]);
+    column_end = width - 1;
+  }
+#ifdef PROCESSING_X86_SIMD
+  switch (current_simd_level) {
+  case SIMD_AVX2:
+    cost_row_avx2(prev, energy, out, column_start, column_end);
+    return;
+  case SIMD_SSE2:
+    cost_row_sse2(prev, energy, out, column_start, column_end);
+    return;
+  case SIMD_SCALAR:
+    break;
+  }
+#endif
+  cost_row_scalar(prev, energy, out, column_start, column_end);
+}
+
+// ------------------------------------------------------------------
+// Transpose kernels, used by the rotations.
+//
+// A rotation by 90 degrees is a transpose in which the rows of either the
+// source or the destination are visited in reverse order. The Matrix is
+// cut into TRANSPOSE_TILE by TRANSPOSE_TILE tiles that fit in the L1
+// cache together with their destination, and each tile into
+// TRANSPOSE_BLOCK by TRANSPOSE_BLOCK blocks transposed in registers.
+
+// Side of the blocks transposed in registers: 16 rows of 16 bytes fill
+// the 16 SSE2 registers.
+const int TRANSPOSE_BLOCK = 16;
+
+// Side of the cache tiles, a multiple of TRANSPOSE_BLOCK.
+const int TRANSPOSE_TILE = 64;
+
+// REQUIRES: in and out each point to TRANSPOSE_BLOCK row pointers
+// MODIFIES: out[k][out_column]...out[k][out_column+TRANSPOSE_BLOCK-1]
+// EFFECTS:  Sets out[k][out_column + i] to in[i][in_column + k] for every
+//           i and k below TRANSPOSE_BLOCK.
+template <typename T>
+static void transpose_block_scalar(const T* const in[], int in_column,
+                                   T* const out[], int out_column) {
+  for (int k = 0; k < TRANSPOSE_BLOCK; ++k) {
+    for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+      out[k][out_column + i] = in[i][in_column + k];
+    }
+  }
+}
+
+#ifdef PROCESSING_X86_SIMD
+
+// Same as transpose_block_scalar, for bytes, in registers. Interleaving
+// rows i and i + 8 into rows 2i and 2i + 1 moves the element at row R,
+// column C (4 bits each) to the place whose 8-bit index RC is rotated
+// left by one bit, so four rounds swap R and C.
+static void transpose_block_sse2(const uint8_t* const in[], int in_column,
+                                 uint8_t* const out[], int out_column) {
+  __m128i rows[TRANSPOSE_BLOCK];
+  for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+    rows[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[i] + in_column));
+  }
+  for (int round = 0; round < 4; ++round) {
+    __m128i next[TRANSPOSE_BLOCK];
+    for (int i = 0; i < TRANSPOSE_BLOCK / 2; ++i) {
+      next[2 * i] = _mm_unpacklo_epi8(rows[i], rows[i + 8]);
+      next[2 * i + 1] = _mm_unpackhi_epi8(rows[i], rows[i + 8]);
+    }
+    for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+      rows[i] = next[i];
+    }
+  }
+  for (int k = 0; k < TRANSPOSE_BLOCK; ++k) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out[k] + out_column), rows[k]);
+  }
+}
+
+#endif // PROCESSING_X86_SIMD
+
+// Same as transpose_block_scalar, using the current Simd_level. The AVX2
+// level uses the SSE2 kernel too: a block already fills every register.
+static void transpose_block(const uint8_t* const in[], int in_column,
+                            uint8_t* const out[], int out_column) {
+#ifdef PROCESSING_X86_SIMD
+  if (current_simd_level != SIMD_SCALAR) {
+    transpose_block_sse2(in, in_column, out, out_column);
+    return;
+  }
+#endif
+  transpose_block_scalar(in, in_column, out, out_column);
+}
+
+// Same as transpose_block_scalar. The 3-byte pixels of interleaved
+// Images don't fit the byte shuffles, so they only get the cache tiling.
+static void transpose_block(const Byte_rgb* const in[], int in_column,
+                            Byte_rgb* const out[], int out_column) {
+  transpose_block_scalar(in, in_column, out, out_column);
+}
+
+// The two ways to turn a Matrix by 90 degrees.
+enum Rotation { ROTATE_LEFT, ROTATE_RIGHT };
+
+// REQUIRES: src points to a valid Matrix
+//           dst points to a Matrix other than src
+// MODIFIES: *dst
+// EFFECTS:  Initializes dst to be src rotated 90 degrees in the given
+//           direction. With more than one thread, bands of rows of src
+//           are rotated concurrently.
+template <typename T>
+static void rotate_matrix(const Basic_matrix<T>* src, Basic_matrix<T>* dst,
+                          Rotation rotation) {
+  const int width = Matrix_width(src);
+  const int height = Matrix_height(src);
+  Matrix_init(dst, height, width);
+  const bool left = rotation == ROTATE_LEFT;
+
+  // Moves the element at row r, column c of src to its place in dst.
+  auto place = [&](int r, int c) {
+    if (left) {
+      Matrix_row_span(dst, width - 1 - c)[r] = Matrix_row_span(src, r)[c];
+    } else {
+      Matrix_row_span(dst, c)[height - 1 - r] = Matrix_row_span(src, r)[c];
+    }
+  };
+
+  // The whole blocks, tile by tile. Rotating left reverses the order of
+  // the destination rows; rotating right, the order of the source rows.
+  const int block_rows = height / TRANSPOSE_BLOCK;
+  const int full_width = width - width % TRANSPOSE_BLOCK;
+  const int full_height = block_rows * TRANSPOSE_BLOCK;
+  for_each_band(0, block_rows, num_bands(block_rows), [&](int, int band_start, int band_end) {
+    const int row_start = band_start * TRANSPOSE_BLOCK;
+    const int row_end = band_end * TRANSPOSE_BLOCK;
+    const T* in[TRANSPOSE_BLOCK];
+    T* out[TRANSPOSE_BLOCK];
+    for (int tile_row = row_start; tile_row < row_end; tile_row += TRANSPOSE_TILE) {
+      for (int tile_column = 0; tile_column < full_width; tile_column += TRANSPOSE_TILE) {
+        const int tile_row_end = min(tile_row + TRANSPOSE_TILE, row_end);
+        const int tile_column_end = min(tile_column + TRANSPOSE_TILE, full_width);
+        for (int r = tile_row; r < tile_row_end; r += TRANSPOSE_BLOCK) {
+          for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+            in[i] = Matrix_row_span(src, left ? r + i : r + TRANSPOSE_BLOCK - 1 - i).data;
+          }
+          const int out_column = left ? r : height - TRANSPOSE_BLOCK - r;
+          for (int c = tile_column; c < tile_column_end; c += TRANSPOSE_BLOCK) {
+            for (int k = 0; k < TRANSPOSE_BLOCK; ++k) {
+              out[k] = Matrix_row_span(dst, left ? width - 1 - c - k : c + k).data;
+            }
+            transpose_block(in, c, out, out_column);
+          }
+        }
+      }
+    }
+  });
+
+  // The partial blocks along the right and bottom edges.
+  for (int r = 0; r < full_height; ++r) {
+    for (int c = full_width; c < width; ++c) {
+      place(r, c);
+    }
+  }
+  for (int r = full_height; r < height; ++r) {
     for (int c = 0; c < width; ++c) {
-      Image_set_pixel(aux, width - 1 - c, r, Image_get_pixel(img, r, c));
+      place(r, c);
     }
   }
+}
+
+// REQUIRES: mat points to a valid Matrix
+//           Matrix_width(mat) == Matrix_height(mat)
+// MODIFIES: *mat
+// EFFECTS:  Transposes the Matrix in place: the element at row r, column c
+//           moves to row c, column r. Each pair of blocks mirrored across
+//           the diagonal is swapped through a block of scratch space.
+template <typename T>
+static void transpose_in_place(Basic_matrix<T>* mat) {
+  const int size = Matrix_width(mat);
+  const int full_size = size - size % TRANSPOSE_BLOCK;
+  T scratch[TRANSPOSE_BLOCK][TRANSPOSE_BLOCK];
+  const T* in[TRANSPOSE_BLOCK];
+  T* out[TRANSPOSE_BLOCK];
+  const T* saved[TRANSPOSE_BLOCK];
+  T* scratch_rows[TRANSPOSE_BLOCK];
+  for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+    scratch_rows[i] = scratch[i];
+    saved[i] = scratch[i];
+  }
 
-  // Copy data back into original
-  *img = *aux;
-  delete aux;
+  for (int r = 0; r < full_size; r += TRANSPOSE_BLOCK) {
+    for (int c = r; c < full_size; c += TRANSPOSE_BLOCK) {
+      // The block at (r, c) goes to scratch, the one at (c, r) takes its
+      // place, and scratch goes to (c, r).
+      for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+        in[i] = Matrix_row_span(mat, r + i).data;
+      }
+      transpose_block(in, c, scratch_rows, 0);
+      if (c != r) {
+        for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+          in[i] = Matrix_row_span(mat, c + i).data;
+          out[i] = Matrix_row_span(mat, r + i).data;
+        }
+        transpose_block(in, r, out, c);
+      }
+      for (int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+        copy(saved[i], saved[i] + TRANSPOSE_BLOCK,
+             Matrix_row_span(mat, c + i).data + r);
+      }
+    }
+  }
+
+  // The pairs with an element in the partial blocks.
+  for (int c = full_size; c < size; ++c) {
+    for (int r = 0; r < c; ++r) {
+      swap(Matrix_row_span(mat, r)[c], Matrix_row_span(mat, c)[r]);
+    }
+  }
+}
+
+// REQUIRES: mat points to a valid Matrix
+// MODIFIES: *mat
+// EFFECTS:  Reverses the order of the elements of every row.
+template <typename T>
+static void reverse_each_row(Basic_matrix<T>* mat) {
+  for (int r = 0; r < Matrix_height(mat); ++r) {
+    const Matrix_span<T> row = Matrix_row_span(mat, r);
+    reverse(row.begin(), row.end());
+  }
+}
+
+// REQUIRES: mat points to a valid Matrix
+// MODIFIES: *mat
+// EFFECTS:  Reverses the order of the rows.
+template <typename T>
+static void reverse_row_order(Basic_matrix<T>* mat) {
+  const int height = Matrix_height(mat);
+  for (int r = 0; r < height / 2; ++r) {
+    const Matrix_span<T> top = Matrix_row_span(mat, r);
+    swap_ranges(top.begin(), top.end(), Matrix_row_span(mat, height - 1 - r).begin());
+  }
+}
+
+// Below this many columns per thread, the tiled cost matrix schedule
+// isn't worth its synchronization.
+const int MIN_COST_TILE_WIDTH = 64;
+
+// The most rows a cost matrix tile spans.
+const int MAX_COST_TILE_HEIGHT = 64;
+
+// REQUIRES: energy and cost point to valid Matrices of the same size
+//           row 0 of cost is computed
+// MODIFIES: rows 1...Matrix_height(cost)-1 of *cost
+// EFFECTS:  Computes the rest of the vertical cost matrix on the thread
+//           pool, as a wavefront of tiles.
+//           The columns are split into one strip per thread and the rows
+//           into blocks of tile_height rows, at most half the strip width.
+//           Each block is done in two parallel phases. First, each strip
+//           computes the trapezoid of its cells that only depend on cells
+//           within the strip: every row, it loses one column at each
+//           inner strip boundary. Then, each inner strip boundary fills the
+//           triangle of cells around it that the trapezoids left, which
+//           only needs the trapezoid columns next to it. So threads only
+//           synchronize twice per block instead of once per row, and every
+//           cell is computed by the same formula as the serial version.
+static void compute_vertical_cost_matrix_tiled(const Matrix* energy, Matrix* cost,
+                                               int strips) {
+  const int width = Matrix_width(cost);
+  const int height = Matrix_height(cost);
+  const int tile_height = min(MAX_COST_TILE_HEIGHT, width / strips / 2);
+  for (int block_start = 1; block_start < height; block_start += tile_height) {
+    const int block_end = min(block_start + tile_height, height);
+    for_each_band(0, width, strips, [&](int, int strip_start, int strip_end) {
+      for (int r = block_start; r < block_end; ++r) {
+        const int shrink = r - block_start;
+        cost_row(Matrix_row_span(cost, r - 1).data, Matrix_row_span(energy, r).data, Matrix_row_span(cost, r).data, width,
+                 strip_start == 0 ? 0 : strip_start + shrink,
+                 strip_end == width ? width : strip_end - shrink);
+      }
+    });
+    for_each_band(0, width, strips, [&](int, int strip_start, int) {
+      if (strip_start == 0) {
+        return;
+      }
+      for (int r = block_start; r < block_end; ++r) {
+        const int shrink = r - block_start;
+        cost_row(Matrix_row_span(cost, r - 1).data, Matrix_row_span(energy, r).data, Matrix_row_span(cost, r).data, width,
+                 strip_start - shrink, strip_start + shrink);
+      }
+    });
+  }
+}
+
+
+// REQUIRES: img points to a valid Image
+//           1 <= row_start && row_end <= Image_height(img) - 1
+//           window_bytes points to Planar_window_size(Image_width(img))
+//           bytes if img is IMAGE_INTERLEAVED
+//           row_of(r) returns an array of Image_width(img) ints
+// MODIFIES: the arrays returned by row_of, window_bytes
+// EFFECTS:  For each row r in [row_start, row_end), in order, writes the
+//           energies of the non-border pixels of row r into
+//           row_of(r)[1]...row_of(r)[Image_width(img)-2] and then calls
+//           done(r). Returns the largest energy written (or 0 if none).
+template <typename Row_of, typename Done>
+static int compute_energy_rows(const Image* img, int row_start, int row_end,
+                               uint8_t* window_bytes, const Row_of& row_of,
+                               const Done& done) {
+  const int width = Image_width(img);
+  int band_max = 0;
+  if (Image_get_layout(img) == IMAGE_PLANAR){
+    for (int r = row_start; r < row_end; ++r){
+      band_max = max(band_max, energy_row(energy_rows(img, r), row_of(r), width));
+      done(r);
+    }
+    return band_max;
+  }
+  // Interleaved pixels are split into planar rows first, each image row
+  // once per call, so the same kernels handle both layouts.
+  Planar_window window;
+  Planar_window_init(&window, img, window_bytes);
+  if (row_start < row_end){
+    Planar_window_load(&window, img, row_start - 1);
+    Planar_window_load(&window, img, row_start);
+  }
+  for (int r = row_start; r < row_end; ++r){
+    Planar_window_load(&window, img, r + 1);
+    band_max = max(band_max, energy_row(Planar_window_rows(&window, r), row_of(r), width));
+    done(r);
+  }
+  return band_max;
+}
+
+// REQUIRES: img points to a valid Image
+//           scratch points to a vector
+//           row_of(band, r) returns an array of Image_width(img) ints
+// MODIFIES: the arrays returned by row_of, *scratch
+// EFFECTS:  Computes the energies of the non-border pixels of img into the
+//           arrays returned by row_of, in bands of rows on the thread
+//           pool, and returns the largest (or 0 if none). Interleaved rows
+//           are split in scratch.
+template <typename Row_of>
+static int compute_energy_bands(const Image* img, vector<uint8_t>* scratch,
+                                const Row_of& row_of) {
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+
+  // Each band folds its own maximum into the overall one, which doesn't
+  // depend on how the rows were split.
+  const int bands = num_bands(height - 2);
+  atomic<int> max_energy(0);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    scratch->resize(bands * Planar_window_size(width));
+  }
+  for_each_band(1, max(height - 1, 1), bands, [&](int band, int row_start, int row_end) {
+    const int band_max = compute_energy_rows(
+        img, row_start, row_end, scratch->data() + band * Planar_window_size(width),
+        [&](int r) { return row_of(band, r); }, [](int) {});
+    int current = max_energy.load();
+    while (band_max > current && !max_energy.compare_exchange_weak(current, band_max)) {
+    }
+  });
+  return max_energy.load();
+}
+
+// REQUIRES: img points to a valid Image
+//           energy points to a Matrix
+//           scratch points to a vector
+// MODIFIES: *energy, *scratch
+// EFFECTS:  Same as compute_energy_matrix(img, energy), keeping the rows
+//           of an IMAGE_INTERLEAVED Image in scratch while they are split,
+//           so nothing is allocated once scratch and energy are big
+//           enough.
+static void compute_energy_matrix(const Image* img, Matrix* energy,
+                                  vector<uint8_t>* scratch) {
+  INSTRUMENT_SCOPE(STAGE_ENERGY, static_cast<long long>(Image_width(img)) * Image_height(img));
+  Matrix_init(energy, Image_width(img), Image_height(img));
+  const int max_energy = compute_energy_bands(img, scratch, [energy](int, int r) {
+    return Matrix_row_span(energy, r).data;
+  });
+  Matrix_fill_border(energy, max_energy);
 }
-// ^ DO NOT CHANGE ^ ------------------------------------------------
 
-// v DO NOT CHANGE v ------------------------------------------------
-// The implementation of rotate_right is provided for you.
 // REQUIRES: img points to a valid Image.
-// MODIFIES: *img
-// EFFECTS:  The image is rotated 90 degrees to the right (clockwise).
-void rotate_right(Image* img){
+//           energy points to a Matrix.
+// MODIFIES: *energy
+// EFFECTS:  energy serves as an "output parameter".
+//           The Matrix pointed to by energy is initialized to be the same
+//           size as the given Image, and then the energy matrix for that
+//           image is computed and written into it.
+//           See the project spec for details on computing the energy matrix.
+// NOTE:     Whole rows are computed at a time by the vectorized kernel for
+//           the current Simd_level, which also tracks the maximum energy.
+//           With more than one thread (see set_num_threads), the rows are
+//           split into bands computed concurrently.
+void compute_energy_matrix(const Image* img, Matrix* energy) {
+  vector<uint8_t> scratch;
+  compute_energy_matrix(img, energy, &scratch);
+}
+
+
+// MODIFIES: *tracker
+// EFFECTS:  Records a non-border element with the given energy.
+static void Energy_tracker_add(Energy_tracker* tracker, int value) {
+  if (value >= static_cast<int>(tracker->counts.size())) {
+    tracker->counts.resize(value + 1, 0);
+  }
+  ++tracker->counts[value];
+  if (value > tracker->max_energy) {
+    tracker->max_energy = value;
+  }
+}
+
+// REQUIRES: value was previously recorded with Energy_tracker_add
+// MODIFIES: *tracker
+// EFFECTS:  Forgets a non-border element with the given energy.
+//           tracker->max_energy may be stale until the next call to
+//           Energy_tracker_fill_border.
+static void Energy_tracker_drop(Energy_tracker* tracker, int value) {
+  assert(tracker->counts[value] > 0);
+  --tracker->counts[value];
+}
+
+// MODIFIES: *tracker
+// EFFECTS:  Brings tracker->max_energy up to date and writes it into the
+//           border of tracker->energy. The max only ever has to walk down
+//           past values that are no longer present.
+static void Energy_tracker_fill_border(Energy_tracker* tracker) {
+  while (tracker->max_energy > 0 && tracker->counts[tracker->max_energy] == 0) {
+    --tracker->max_energy;
+  }
+  Matrix_fill_border(&tracker->energy, tracker->max_energy);
+}
+
+// REQUIRES: tracker points to an Energy_tracker
+//           img points to a valid Image
+// MODIFIES: *tracker
+// EFFECTS:  Computes the energy matrix of img into tracker->energy, exactly
+//           as compute_energy_matrix does, and starts tracking it.
+void Energy_tracker_init(Energy_tracker* tracker, const Image* img) {
+  Matrix* energy = &tracker->energy;
+  compute_energy_matrix(img, energy, &tracker->scratch);
+  tracker->counts.assign(1, 0);
+  tracker->max_energy = 0;
+  for (int r = 1; r < Matrix_height(energy) - 1; ++r){
+    const Matrix_span<const int> row = Matrix_row_span(energy, r);
+    for (int c = 1; c < row.length - 1; ++c){
+      Energy_tracker_add(tracker, row[c]);
+    }
+  }
+}
+
+// REQUIRES: tracker was initialized with an Image that has since had
+//           exactly one vertical seam removed, giving img
+//           seam is the seam that was removed
+// MODIFIES: *tracker
+// EFFECTS:  Updates tracker->energy to be the energy matrix of img. The
+//           old energies are shifted along with the seam and only the
+//           elements next to it are recomputed. The result is identical
+//           to calling compute_energy_matrix(img, &tracker->energy).
+void Energy_tracker_remove_seam(Energy_tracker* tracker, const Image* img,
+                                const int seam[]) {
+  INSTRUMENT_SCOPE(STAGE_ENERGY, Image_height(img));
+  Matrix* energy = &tracker->energy;
+  const int height = Matrix_height(energy);
+  const int old_width = Matrix_width(energy);
+  assert(Image_height(img) == height);
+  assert(Image_width(img) == old_width - 1);
+
+  // Forgets the removed elements, and the ones that are about to become
+  // part of the new first or last column.
+  for (int r = 1; r < height - 1; ++r){
+    const int s = seam[r];
+    if (0 < s && s < old_width - 1){
+      Energy_tracker_drop(tracker, Matrix_row_span(energy, r)[s]);
+    }
+    else if (old_width > 2){
+      const int new_border = (s == 0) ? 1 : old_width - 2;
+      Energy_tracker_drop(tracker, Matrix_row_span(energy, r)[new_border]);
+    }
+  }
+
+  Matrix_remove_vertical_seam(energy, seam);
+
+  // An element's energy only changes if one of its four neighbors changed,
+  // which is limited to the columns around the seam in this row and the
+  // rows above and below.
+  const int width = old_width - 1;
+  for (int r = 1; r < height - 1; ++r){
+    const int lo_seam = min(seam[r - 1], min(seam[r], seam[r + 1]));
+    const int hi_seam = max(seam[r - 1], max(seam[r], seam[r + 1]));
+    const int column_start = max(lo_seam - 1, 1);
+    const int column_end = min(hi_seam, width - 2); // column inclusive
+    const Matrix_span<int> row = Matrix_row_span(energy, r);
+    for (int c = column_start; c <= column_end; ++c){
+      int& element = row[c];
+      Energy_tracker_drop(tracker, element);
+      element = pixel_energy(img, r, c);
+      Energy_tracker_add(tracker, element);
+    }
+  }
+
+  Energy_tracker_fill_border(tracker);
+}
+
+
+// REQUIRES: tracker was initialized with an Image that has since had
+//           exactly one horizontal seam removed, giving img
+//           seam is the seam that was removed
+// MODIFIES: *tracker
+// EFFECTS:  Same as Energy_tracker_remove_seam, for a horizontal seam.
+void Energy_tracker_remove_horizontal_seam(Energy_tracker* tracker,
+                                           const Image* img,
+                                           const int seam[]) {
+  INSTRUMENT_SCOPE(STAGE_ENERGY, Image_width(img));
+  Matrix* energy = &tracker->energy;
+  const int width = Matrix_width(energy);
+  const int old_height = Matrix_height(energy);
+  assert(Image_width(img) == width);
+  assert(Image_height(img) == old_height - 1);
+
+  // Forgets the removed elements, and the ones that are about to become
+  // part of the new first or last row.
+  for (int c = 1; c < width - 1; ++c){
+    const int s = seam[c];
+    if (0 < s && s < old_height - 1){
+      Energy_tracker_drop(tracker, Matrix_row_span(energy, s)[c]);
+    }
+    else if (old_height > 2){
+      const int new_border = (s == 0) ? 1 : old_height - 2;
+      Energy_tracker_drop(tracker, Matrix_row_span(energy, new_border)[c]);
+    }
+  }
+
+  Matrix_remove_horizontal_seam(energy, seam);
+
+  // Only the rows around the seam in this column and the columns to the
+  // left and right can have new energy.
+  const int height = old_height - 1;
+  for (int c = 1; c < width - 1; ++c){
+    const int lo_seam = min(seam[c - 1], min(seam[c], seam[c + 1]));
+    const int hi_seam = max(seam[c - 1], max(seam[c], seam[c + 1]));
+    const int row_start = max(lo_seam - 1, 1);
+    const int row_end = min(hi_seam, height - 2); // row inclusive
+    for (int r = row_start; r <= row_end; ++r){
+      int& element = Matrix_row_span(energy, r)[c];
+      Energy_tracker_drop(tracker, element);
+      element = pixel_energy(img, r, c);
+      Energy_tracker_add(tracker, element);
+    }
+  }
+
+  Energy_tracker_fill_border(tracker);
+}
+
 
-  // for convenience
-  int width = Image_width(img);
-  int height = Image_height(img);
+// REQUIRES: energy points to a valid Matrix.
+//           cost points to a Matrix.
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  cost serves as an "output parameter".
+//           The Matrix pointed to by cost is initialized to be the same
+//           size as the given energy Matrix, and then the cost matrix is
+//           computed and written into it.
+//           See the project spec for details on computing the cost matrix.
+// NOTE:     Whole rows are computed at a time by the vectorized kernel for
+//           the current Simd_level. With more than one thread (see
+//           set_num_threads) and a wide enough matrix, tiles of rows and
+//           columns are computed concurrently in a wavefront instead.
+void compute_vertical_cost_matrix(const Matrix* energy, Matrix *cost) {
+  assert(energy != cost);
+  INSTRUMENT_SCOPE(STAGE_DP, static_cast<long long>(Matrix_width(energy)) * Matrix_height(energy));
+  Matrix_init(cost, Matrix_width(energy), Matrix_height(energy));
 
-  // auxiliary image to temporarily store rotated image
-  Image *aux = new Image;
-  Image_init(aux, height, width); // width and height switched
+  // Sets the cost for each pixel in row 0 as the energy for the pixel. 
+  const int width = Matrix_width(cost);
+  const Matrix_span<const int> first_row = Matrix_row_span(energy, 0);
+  std::copy(first_row.begin(), first_row.end(), Matrix_row_span(cost, 0).data);
 
-  // iterate through pixels and place each where it goes in temp
+  // Calculates the cost for the remaining pixels that aren't in row 0,
+  // a whole row at a time, or in tiles when there are several threads.
+  const int strips = num_bands(width / MIN_COST_TILE_WIDTH);
+  if (strips > 1) {
+    compute_vertical_cost_matrix_tiled(energy, cost, strips);
+    return;
+  }
+  for (int r = 1; r < Matrix_height(energy); ++r) {
+    cost_row(Matrix_row_span(cost, r - 1).data, Matrix_row_span(energy, r).data, Matrix_row_span(cost, r).data, width, 0, width);
+  }
+}
+
+
+// REQUIRES: img points to a valid Image at least 3 pixels wide and high
+//           cost points to a Matrix
+//           row points to an array of Image_width(img) ints
+//           window_bytes points to Planar_window_size(Image_width(img))
+//           bytes if img is IMAGE_INTERLEAVED
+// MODIFIES: *cost, row, window_bytes
+// EFFECTS:  Computes the vertical cost matrix of img into cost as if the
+//           border energy were border, folding each energy row, kept in
+//           row, into the cost matrix as soon as it is computed. Returns
+//           the largest non-border energy, which is the real border
+//           energy.
+static int compute_cost_matrix_fused(const Image* img, Matrix* cost, int border,
+                                     int* row, uint8_t* window_bytes) {
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  Matrix_init(cost, width, height);
+  const Matrix_span<int> first_costs = Matrix_row_span(cost, 0);
+  fill(first_costs.begin(), first_costs.end(), border);
+  const int max_energy = compute_energy_rows(img, 1, height - 1, window_bytes,
+                                             [row](int) { return row; }, [&](int r) {
+    row[0] = border;
+    row[width - 1] = border;
+    cost_row(Matrix_row_span(cost, r - 1).data, row, Matrix_row_span(cost, r).data,
+             width, 0, width);
+  });
+  fill(row, row + width, border);
+  cost_row(Matrix_row_span(cost, height - 2).data, row,
+           Matrix_row_span(cost, height - 1).data, width, 0, width);
+  return max_energy;
+}
+
+// REQUIRES: cost is the vertical cost matrix of an energy matrix at least
+//           3 wide and high, computed with border energy border + delta
+//           delta >= 0 and border >= every non-border energy
+// MODIFIES: *cost
+// EFFECTS:  Makes cost the cost matrix for border energy border.
+// NOTE:     A border energy no smaller than every other energy means no
+//           cheapest path to a non-border cell goes through the left or
+//           right column, and every path to a cell in those columns or in
+//           the last row goes through exactly one of them after row 0, so
+//           each cost holds the border energy once or twice.
+static void lower_cost_matrix_border(Matrix* cost, int delta) {
+  const int width = Matrix_width(cost);
+  const int height = Matrix_height(cost);
   for (int r = 0; r < height; ++r) {
-    for (int c = 0; c < width; ++c) {
-      Image_set_pixel(aux, c, height - 1 - r, Image_get_pixel(img, r, c));
+    const Matrix_span<int> costs = Matrix_row_span(cost, r);
+    const int twice = (r > 0) ? 2 * delta : delta;
+    if (r == height - 1) {
+      for (int& value : costs) {
+        value -= twice;
+      }
+      continue;
     }
+    costs[0] -= twice;
+    costs[width - 1] -= twice;
+    for (int c = 1; c < width - 1; ++c) {
+      costs[c] -= delta;
+    }
+  }
+}
+
+// REQUIRES: img points to a valid Image
+//           energy and cost point to different Matrices
+//           border_energy points to an int
+//           scratch and energy_rows point to vectors
+// MODIFIES: *energy, *cost, *border_energy, *scratch, *energy_rows
+// EFFECTS:  Computes the vertical cost matrix of img into cost, as
+//           compute_energy_and_cost_matrices does. The energy matrix is
+//           stored in energy if store_energy is true; otherwise energy
+//           is only used if the two stages have to run one after the
+//           other. *border_energy is a guess of the border energy on
+//           entry, and is set to the real one.
+//           Interleaved rows are split in scratch and the energy rows of
+//           the fused pass are kept in energy_rows, so nothing is
+//           allocated once they are big enough.
+static void compute_energy_and_cost_matrices(const Image* img, Matrix* energy,
+                                             Matrix* cost, bool store_energy,
+                                             int* border_energy,
+                                             vector<uint8_t>* scratch,
+                                             vector<int>* energy_rows) {
+  assert(energy != cost);
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  if (store_energy || width < 3 || height < 3 ||
+      num_bands(width / MIN_COST_TILE_WIDTH) > 1) {
+    compute_energy_matrix(img, energy, scratch);
+    compute_vertical_cost_matrix(energy, cost);
+    *border_energy = *Matrix_row_span(energy, 0).data;
+    return;
   }
+  INSTRUMENT_SCOPE(STAGE_ENERGY_DP, static_cast<long long>(width) * height);
 
-  // Copy data back into original
-  *img = *aux;
-  delete aux;
+  // The border energy is the largest of the others, so it is only known
+  // once every energy row has been computed. The fused pass starts from
+  // the guess. A guess that was too high is corrected in place, and one
+  // that was too low is redone with the real value.
+  energy_rows->resize(width);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED){
+    scratch->resize(Planar_window_size(width));
+  }
+  const int guess = *border_energy;
+  const int border = compute_cost_matrix_fused(img, cost, guess, energy_rows->data(),
+                                               scratch->data());
+  if (border < guess) {
+    lower_cost_matrix_border(cost, guess - border);
+  } else if (border > guess) {
+    compute_cost_matrix_fused(img, cost, border, energy_rows->data(), scratch->data());
+  }
+  *border_energy = border;
 }
-// ^ DO NOT CHANGE ^ ------------------------------------------------
 
+// REQUIRES: img points to a valid Image
+//           energy is null or points to a Matrix other than cost
+//           cost points to a Matrix
+//           border_energy points to an int
+// MODIFIES: *energy, *cost, *border_energy
+// EFFECTS:  Computes the vertical cost matrix of img into cost, exactly as
+//           compute_energy_matrix followed by compute_vertical_cost_matrix
+//           would, and the energy matrix into energy unless it is null.
+//           *border_energy is a guess of the border energy on entry, and
+//           is set to the real one.
+void compute_energy_and_cost_matrices(const Image* img, Matrix* energy, Matrix* cost,
+                                      int* border_energy) {
+  Matrix storage;
+  vector<uint8_t> scratch;
+  vector<int> energy_rows;
+  compute_energy_and_cost_matrices(img, energy ? energy : &storage, cost,
+                                   energy != nullptr, border_energy, &scratch,
+                                   &energy_rows);
+}
 
-// v DO NOT CHANGE v ------------------------------------------------
-// The implementation of diff2 is provided for you.
-static int squared_difference(Pixel p1, Pixel p2) {
-  int dr = p2.r - p1.r;
-  int dg = p2.g - p1.g;
-  int db = p2.b - p1.b;
-  // Divide by 100 is to avoid possible overflows
-  // later on in the algorithm.
-  return (dr*dr + dg*dg + db*db) / 100;
+
+// REQUIRES: energy points to a valid Matrix, obtained by removing the
+//           given vertical seam from an energy matrix E and then updating
+//           it as Energy_tracker_remove_seam does: away from the border,
+//           elements differ from E only within one column of the seam
+//           in the same row or the rows above and below, and the border
+//           holds a single value.
+//           cost points to the cost matrix of E
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  Updates cost to be the cost matrix of energy. The old costs are
+//           shifted along with the seam and only the cells that can have
+//           changed are recomputed: a band around the seam plus, row by
+//           row, the neighbors of cells that actually changed in the row
+//           above. The result is identical to compute_vertical_cost_matrix.
+void update_vertical_cost_matrix(const Matrix* energy, Matrix* cost,
+                                 const int seam[]) {
+  assert(energy != cost);
+  const int width = Matrix_width(energy);
+  const int height = Matrix_height(energy);
+  assert(Matrix_width(cost) == width + 1);
+  assert(Matrix_height(cost) == height);
+
+  // Row 0 of the cost matrix is row 0 of the energy matrix, which is all
+  // border. If the border value changed, every row changed at both ends,
+  // so there is nothing to gain over a full recompute. Row 0 is all border
+  // before the seam is removed too, so this is checked first.
+  if (Matrix_row_span(cost, 0)[0] != Matrix_row_span(energy, 0)[0]) {
+    compute_vertical_cost_matrix(energy, cost);
+    return;
+  }
+  INSTRUMENT_SCOPE(STAGE_DP, height);
+  Matrix_remove_vertical_seam(cost, seam);
+
+  // Columns (inclusive) of the cells in the previous row whose cost
+  // changed. Empty when changed_start > changed_end.
+  int changed_start = width;
+  int changed_end = -1;
+  for (int r = 0; r < height; ++r) {
+    // Cells near the seam may have new energy or a new set of neighbors
+    // above them, even if no cost in the row above changed.
+    const int above = seam[max(r - 1, 0)];
+    const int below = seam[min(r + 1, height - 1)];
+    int column_start = min(above, min(seam[r], below)) - 2;
+    int column_end = max(above, max(seam[r], below)) + 1;
+    // A changed cell can change the three cells below it.
+    if (changed_start <= changed_end) {
+      column_start = min(column_start, changed_start - 1);
+      column_end = max(column_end, changed_end + 1);
+    }
+    column_start = max(column_start, 0);
+    column_end = min(column_end, width - 1);
+
+    changed_start = width;
+    changed_end = -1;
+    const Matrix_span<const int> energies = Matrix_row_span(energy, r);
+    const Matrix_span<int> costs = Matrix_row_span(cost, r);
+    const Matrix_span<int> prev_costs = Matrix_row_span(cost, max(r - 1, 0));
+    for (int c = column_start; c <= column_end; ++c) {
+      int value = energies[c];
+      if (r > 0) {
+        int min_cost = prev_costs[c];
+        if (c > 0) {
+          min_cost = min(min_cost, prev_costs[c - 1]);
+        }
+        if (c < width - 1) {
+          min_cost = min(min_cost, prev_costs[c + 1]);
+        }
+        value += min_cost;
+      }
+      int& element = costs[c];
+      if (element != value) {
+        element = value;
+        changed_start = min(changed_start, c);
+        changed_end = c;
+      }
+    }
+  }
+}
+
+// REQUIRES: cost points to a valid Matrix
+//           seam points to an array
+//           the size of seam is >= Matrix_height(cost)
+// MODIFIES: seam[0]...seam[Matrix_height(cost)-1]
+// EFFECTS:  seam serves as an "output parameter".
+//           The vertical seam with the minimal cost according to the given
+//           cost matrix is found and the seam array is filled with the column
+//           numbers for each pixel along the seam, with the pixel for each
+//           row r placed at seam[r]. While determining the seam, if any pixels
+//           tie for lowest cost, the leftmost one (i.e. with the lowest
+//           column number) is used.
+//           See the project spec for details on computing the minimal seam.
+// NOTE:     You should compute the seam in reverse order, starting
+//           with the bottom of the image and proceeding to the top,
+//           as described in the project spec.
+void find_minimal_vertical_seam(const Matrix* cost, int seam[]) {
+  INSTRUMENT_SCOPE(STAGE_BACKTRACK, Matrix_height(cost));
+  int column = Matrix_column_of_min_value_in_row(cost, Matrix_height(cost) - 1, 0, Matrix_width(cost));
+  seam[Matrix_height(cost) - 1] = column;
+
+  for (int r = Matrix_height(cost) - 1; r > 0; --r){
+    int column_start = column - 1; // column inclusive
+    int column_end = column + 2; // column exclusive
+    
+    if (column_start < 0) {
+        column_start = 0;
+    }
+    if (column_end > Matrix_width(cost)) {
+        column_end = Matrix_width(cost);
+    } 
+
+    column = Matrix_column_of_min_value_in_row(cost, r - 1, column_start, column_end);
+    seam[r - 1] = column;  
+  }
+}
+
+
+// REQUIRES: prev points to an array of width ints
+//           directions points to an array of width int8_t
+// MODIFIES: directions[0]...directions[width-1]
+// EFFECTS:  Writes, for each column, the offset of the element in prev
+//           with the minimal cost among its (up to three) neighbors above,
+//           the leftmost on ties.
+static void backpointer_row(const int* prev, int8_t* directions, int width) {
+  if (width == 1) {
+    directions[0] = 0;
+    return;
+  }
+  directions[0] = prev[1] < prev[0] ? 1 : 0;
+  for (int c = 1; c < width - 1; ++c) {
+    int direction = -1;
+    int min_cost = prev[c - 1];
+    if (prev[c] < min_cost) {
+      direction = 0;
+      min_cost = prev[c];
+    }
+    if (prev[c + 1] < min_cost) {
+      direction = 1;
+    }
+    directions[c] = static_cast<int8_t>(direction);
+  }
+  directions[width - 1] = prev[width - 1] < prev[width - 2] ? 0 : -1;
+}
+
+// REQUIRES: energy points to a valid Matrix
+//           backpointers points to a Seam_backpointers
+// MODIFIES: *backpointers
+// EFFECTS:  Runs the same dynamic program as compute_vertical_cost_matrix,
+//           but with two rolling rows of costs, and records the
+//           backpointers of every element instead of its cost. The
+//           buffers are reused from earlier calls.
+void compute_vertical_seam_backpointers(const Matrix* energy,
+                                        Seam_backpointers* backpointers) {
+  const int width = Matrix_width(energy);
+  const int height = Matrix_height(energy);
+  INSTRUMENT_SCOPE(STAGE_DP, static_cast<long long>(width) * height);
+  backpointers->width = width;
+  backpointers->height = height;
+  backpointers->directions.resize(static_cast<size_t>(width) * height);
+  backpointers->last_row_costs.resize(width);
+  backpointers->previous_row_costs.resize(width);
+
+  // Row 0 has nothing above it, so its backpointers are never followed.
+  int* costs = backpointers->last_row_costs.data();
+  copy(Matrix_row_span(energy, 0).data, Matrix_row_span(energy, 0).data + width, costs);
+  fill(backpointers->directions.begin(), backpointers->directions.begin() + width, 0);
+  for (int r = 1; r < height; ++r) {
+    swap(backpointers->last_row_costs, backpointers->previous_row_costs);
+    const int* prev = backpointers->previous_row_costs.data();
+    costs = backpointers->last_row_costs.data();
+    backpointer_row(prev, &backpointers->directions[static_cast<size_t>(r) * width], width);
+    cost_row(prev, Matrix_row_span(energy, r).data, costs, width, 0, width);
+  }
+}
+
+// REQUIRES: backpointers was computed by compute_vertical_seam_backpointers
+//           seam points to an array
+//           the size of seam is >= backpointers->height
+// MODIFIES: seam[0]...seam[backpointers->height-1]
+// EFFECTS:  Same as find_minimal_vertical_seam on the cost matrix of the
+//           same energy Matrix, but the seam is found by following one
+//           backpointer per row instead of rescanning the costs.
+void find_minimal_vertical_seam(const Seam_backpointers* backpointers,
+                                int seam[]) {
+  INSTRUMENT_SCOPE(STAGE_BACKTRACK, backpointers->height);
+  const vector<int>& costs = backpointers->last_row_costs;
+  int column = static_cast<int>(min_element(costs.begin(), costs.end()) - costs.begin());
+  for (int r = backpointers->height - 1; r >= 0; --r) {
+    seam[r] = column;
+    column += backpointers->directions[static_cast<size_t>(r) * backpointers->width + column];
+  }
+}
+
+static Seam_dp_mode current_seam_dp_mode = SEAM_DP_COST_MATRIX;
+
+// MODIFIES: the way seam_carve_width finds its seams
+// EFFECTS:  Makes seam_carve_width use the given Seam_dp_mode.
+void set_seam_dp_mode(Seam_dp_mode mode) {
+  current_seam_dp_mode = mode;
+}
+
+// EFFECTS: Returns the Seam_dp_mode used by seam_carve_width.
+Seam_dp_mode get_seam_dp_mode() {
+  return current_seam_dp_mode;
+}
+
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: the matrices of img, through body
+// EFFECTS:  Calls body on each Matrix that holds pixels of img in its
+//           layout: the three channels, or the interleaved pixels. Moving
+//           pixels around is the same operation on either kind of Matrix.
+template <typename Body>
+static void for_each_pixel_matrix(Image *img, Body body) {
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED) {
+    body(&img->pixels);
+  } else {
+    body(&img->red_channel);
+    body(&img->green_channel);
+    body(&img->blue_channel);
+  }
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  Rotates every pixel Matrix of img 90 degrees in the given
+//           direction. A square Image is transposed in place and then
+//           mirrored; any other is rotated into new storage.
+static void rotate_image(Image* img, Rotation rotation) {
+  INSTRUMENT_SCOPE(STAGE_ROTATION, static_cast<long long>(Image_width(img)) * Image_height(img));
+  if (Image_width(img) == Image_height(img)) {
+    for_each_pixel_matrix(img, [&](auto* mat) {
+      transpose_in_place(mat);
+      if (rotation == ROTATE_LEFT) {
+        reverse_row_order(mat);
+      } else {
+        reverse_each_row(mat);
+      }
+    });
+    return;
+  }
+  for_each_pixel_matrix(img, [&](auto* mat) {
+    std::remove_pointer_t<decltype(mat)> rotated;
+    rotate_matrix(mat, &rotated, rotation);
+    *mat = std::move(rotated);
+  });
+  swap(img->width, img->height);
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is rotated 90 degrees to the left (counterclockwise).
+// NOTE:     The pixels are moved in cache-sized tiles of blocks that are
+//           transposed in registers (see rotate_matrix), rather than one
+//           Image_set_pixel at a time, and square Images are rotated in
+//           place.
+void rotate_left(Image* img) {
+  rotate_image(img, ROTATE_LEFT);
+}
+
+// REQUIRES: img points to a valid Image.
+// MODIFIES: *img
+// EFFECTS:  The image is rotated 90 degrees to the right (clockwise).
+// NOTE:     Same as rotate_left.
+void rotate_right(Image* img) {
+  rotate_image(img, ROTATE_RIGHT);
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is rotated 180 degrees, in place.
+void rotate_180(Image* img) {
+  INSTRUMENT_SCOPE(STAGE_ROTATION, static_cast<long long>(Image_width(img)) * Image_height(img));
+  for_each_pixel_matrix(img, [](auto* mat) {
+    reverse_row_order(mat);
+    reverse_each_row(mat);
+  });
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is mirrored left to right, in place.
+void flip_horizontal(Image* img) {
+  INSTRUMENT_SCOPE(STAGE_ROTATION, static_cast<long long>(Image_width(img)) * Image_height(img));
+  for_each_pixel_matrix(img, [](auto* mat) {
+    reverse_each_row(mat);
+  });
+}
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is mirrored top to bottom, in place.
+void flip_vertical(Image* img) {
+  INSTRUMENT_SCOPE(STAGE_ROTATION, static_cast<long long>(Image_width(img)) * Image_height(img));
+  for_each_pixel_matrix(img, [](auto* mat) {
+    reverse_row_order(mat);
+  });
+}
+
+// REQUIRES: img points to a valid Image with width >= 2
+//           0 <= row_start && row_start <= row_end
+//           row_end <= Image_height(img)
+// MODIFIES: *img
+// EFFECTS:  Removes the seam pixel from rows [row_start, row_end) of every
+//           channel without changing the width of the Image.
+static void remove_vertical_seam_from_rows(Image *img, const int seam[],
+                                           int row_start, int row_end) {
+  for_each_pixel_matrix(img, [&](auto* mat) {
+    Matrix_remove_seam_from_rows(mat, seam, row_start, row_end);
+  });
+}
+
+// REQUIRES: img points to a valid Image with width >= 2 whose rows have
+//           all had their seam pixel removed
+// MODIFIES: *img
+// EFFECTS:  Drops the last column, which the compaction left unused.
+static void shrink_width_after_seam(Image *img) {
+  const int new_width = Image_width(img) - 1;
+  for_each_pixel_matrix(img, [&](auto* mat) {
+    Matrix_shrink_width(mat, new_width);
+  });
+  img->width = new_width;
+}
+
+// REQUIRES: img points to a valid Image with width >= 2
+//           seam points to an array
+//           the size of seam is == Image_height(img)
+//           each element x in seam satisfies 0 <= x < Image_width(img)
+// MODIFIES: *img
+// EFFECTS:  Removes the given vertical seam from the Image. That is, one
+//           pixel will be removed from every row in the image. The pixel
+//           removed from row r will be the one with column equal to seam[r].
+//           The width of the image will be one less than before.
+//           See the project spec for details on removing a vertical seam.
+// NOTE:     The seam is removed in place: each row of each channel is
+//           compacted with a single memmove and no Image is allocated.
+//           With more than one thread (see set_num_threads), bands of rows
+//           are compacted concurrently on the shared thread pool.
+void remove_vertical_seam(Image *img, const int seam[]) {
+  assert(Image_width(img) >= 2);
+  INSTRUMENT_SCOPE(STAGE_REMOVAL, static_cast<long long>(Image_width(img)) * Image_height(img));
+  const int height = Image_height(img);
+  for_each_band(0, height, num_bands(height), [&](int, int row_start, int row_end) {
+    remove_vertical_seam_from_rows(img, seam, row_start, row_end);
+  });
+  shrink_width_after_seam(img);
 }
-// ^ DO NOT CHANGE ^ ------------------------------------------------
 
 
-// ------------------------------------------------------------------
-// You may change code below this line!
 
-// REQUIRES: mat points to a valid Matrix
-//           0 <= r && r < Matrix_height(mat)
-//           0 <= c && c < Matrix_width(mat)
-// EFFECTS: Returns true if the element is on the Matrix border.  Returns false otherwise. 
-static bool border_element(const Matrix* mat, int r, int c) {
-  if (r == 0 || c == 0 || r == Matrix_height(mat) - 1 || c == Matrix_width(mat) - 1){
-    return true;
-  }
-  return false;
-}
+// REQUIRES: energy points to a valid Matrix.
+//           cost points to a Matrix.
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  cost serves as an "output parameter".
+//           The Matrix pointed to by cost is initialized to be the same
+//           size as the given energy Matrix. Each element in the last
+//           column gets its energy, and every other element gets its
+//           energy plus the minimal cost among the (up to three) elements
+//           in the next column in the rows above, equal and below.
+void compute_horizontal_cost_matrix(const Matrix* energy, Matrix *cost) {
+  assert(energy != cost);
+  INSTRUMENT_SCOPE(STAGE_DP, static_cast<long long>(Matrix_width(energy)) * Matrix_height(energy));
+  const int width = Matrix_width(energy);
+  const int height = Matrix_height(energy);
+  Matrix_init(cost, width, height);
 
-// REQUIRES: img points to a valid Image.
-//           energy points to a Matrix.
-// MODIFIES: *energy
-// EFFECTS:  energy serves as an "output parameter".
-//           The Matrix pointed to by energy is initialized to be the same
-//           size as the given Image, and then the energy matrix for that
-//           image is computed and written into it.
-//           See the project spec for details on computing the energy matrix.
-void compute_energy_matrix(const Image* img, Matrix* energy) {
-  Matrix_init(energy, Image_width(img), Image_height(img));
-  Matrix_fill(energy, 0);
-  for (int r = 0; r < Matrix_height(energy); ++r){
-    for (int c = 0; c < Matrix_width(energy); ++c){
-      // Checks that a element isn't on the Matrix border.
-      if (!border_element(energy, r, c)){
-        int ns_diff = squared_difference(Image_get_pixel(img, r -  1, c), Image_get_pixel(img, r + 1, c));
-        int we_diff = squared_difference(Image_get_pixel(img, r, c - 1), Image_get_pixel(img, r, c + 1));
-        // Sets the energy for a given element.
-        *Matrix_at(energy, r, c) = ns_diff + we_diff;
+  // Walks the columns right to left, since each column depends on the
+  // next. The inner loop runs down a column, a strided walk that touches
+  // a line of energy and of cost per row: consecutive columns only reuse
+  // those lines while 2 * height of them fit in cache, so on tall images
+  // most accesses miss. It is usually run once per carve:
+  // update_horizontal_cost_matrix handles the later seams in place.
+  for (int r = 0; r < height; ++r) {
+    Matrix_row_span(cost, r)[width - 1] = Matrix_row_span(energy, r)[width - 1];
+  }
+  for (int c = width - 2; c >= 0; --c) {
+    for (int r = 0; r < height; ++r) {
+      int min_cost = Matrix_row_span(cost, r)[c + 1];
+      if (r > 0) {
+        min_cost = min(min_cost, Matrix_row_span(cost, r - 1)[c + 1]);
       }
+      if (r < height - 1) {
+        min_cost = min(min_cost, Matrix_row_span(cost, r + 1)[c + 1]);
+      }
+      Matrix_row_span(cost, r)[c] = Matrix_row_span(energy, r)[c] + min_cost;
     }
   }
-  int max_energy = Matrix_max(energy);
-  Matrix_fill_border(energy, max_energy);
 }
 
-
-// REQUIRES: energy points to a valid Matrix.
-//           cost points to a Matrix.
+// REQUIRES: energy points to a valid Matrix, obtained from an energy
+//           matrix E by the removal of the given horizontal seam as
+//           Energy_tracker_remove_horizontal_seam does.
+//           cost points to the horizontal cost matrix of E
 //           energy and cost aren't pointing to the same Matrix
 // MODIFIES: *cost
-// EFFECTS:  cost serves as an "output parameter".
-//           The Matrix pointed to by cost is initialized to be the same
-//           size as the given energy Matrix, and then the cost matrix is
-//           computed and written into it.
-//           See the project spec for details on computing the cost matrix.
-void compute_vertical_cost_matrix(const Matrix* energy, Matrix *cost) {
+// EFFECTS:  Same as update_vertical_cost_matrix, for a horizontal seam. The
+//           result is identical to compute_horizontal_cost_matrix.
+void update_horizontal_cost_matrix(const Matrix* energy, Matrix* cost,
+                                   const int seam[]) {
   assert(energy != cost);
-  Matrix_init(cost, Matrix_width(energy), Matrix_height(energy));
+  const int width = Matrix_width(energy);
+  const int height = Matrix_height(energy);
+  assert(Matrix_width(cost) == width);
+  assert(Matrix_height(cost) == height + 1);
 
-  // Sets the cost for each pixel in row 0 as the energy for the pixel. 
-  for (int c = 0; c < Matrix_width(cost); ++c){
-    *Matrix_at(cost, 0, c) = *Matrix_at(energy, 0, c);
+  // The last column of the cost matrix is all border energy, before the
+  // seam is removed as well as after.
+  if (Matrix_row_span(cost, 0)[width - 1] != Matrix_row_span(energy, 0)[width - 1]) {
+    compute_horizontal_cost_matrix(energy, cost);
+    return;
   }
+  INSTRUMENT_SCOPE(STAGE_DP, width);
+  Matrix_remove_horizontal_seam(cost, seam);
 
-  // Calculates the cost for the remaining pixels that aren't in row 0.
-  for (int r = 1; r < Matrix_height(energy); ++r) {
-    for (int c = 0; c < Matrix_width(energy); ++c) {
-      int column_start = c - 1; // column inclusive
-      int column_end = c + 2; // column exclusive 
-      
-      if (column_start < 0) {
-        column_start = 0;
+  // Rows (inclusive) of the cells in the previous column whose cost
+  // changed. Empty when changed_start > changed_end.
+  int changed_start = height;
+  int changed_end = -1;
+  for (int c = width - 1; c >= 0; --c) {
+    const int right = seam[min(c + 1, width - 1)];
+    const int left = seam[max(c - 1, 0)];
+    int row_start = min(right, min(seam[c], left)) - 2;
+    int row_end = max(right, max(seam[c], left)) + 1;
+    if (changed_start <= changed_end) {
+      row_start = min(row_start, changed_start - 1);
+      row_end = max(row_end, changed_end + 1);
+    }
+    row_start = max(row_start, 0);
+    row_end = min(row_end, height - 1);
+
+    changed_start = height;
+    changed_end = -1;
+    for (int r = row_start; r <= row_end; ++r) {
+      int value = Matrix_row_span(energy, r)[c];
+      if (c < width - 1) {
+        int min_cost = Matrix_row_span(cost, r)[c + 1];
+        if (r > 0) {
+          min_cost = min(min_cost, Matrix_row_span(cost, r - 1)[c + 1]);
+        }
+        if (r < height - 1) {
+          min_cost = min(min_cost, Matrix_row_span(cost, r + 1)[c + 1]);
+        }
+        value += min_cost;
       }
-      if (column_end > Matrix_width(cost)) {
-        column_end = Matrix_width(cost);
+      int* element = &Matrix_row_span(cost, r)[c];
+      if (*element != value) {
+        *element = value;
+        changed_start = min(changed_start, r);
+        changed_end = r;
       }
-        
-      *Matrix_at(cost, r, c) = *Matrix_at(energy, r, c) + Matrix_min_value_in_row(cost, r - 1, column_start, column_end);
     }
   }
 }
 
-
-// REQUIRES: cost points to a valid Matrix
+// REQUIRES: cost points to a valid horizontal cost Matrix
 //           seam points to an array
-//           the size of seam is >= Matrix_height(cost)
-// MODIFIES: seam[0]...seam[Matrix_height(cost)-1]
+//           the size of seam is >= Matrix_width(cost)
+// MODIFIES: seam[0]...seam[Matrix_width(cost)-1]
 // EFFECTS:  seam serves as an "output parameter".
-//           The vertical seam with the minimal cost according to the given
-//           cost matrix is found and the seam array is filled with the column
-//           numbers for each pixel along the seam, with the pixel for each
-//           row r placed at seam[r]. While determining the seam, if any pixels
-//           tie for lowest cost, the leftmost one (i.e. with the lowest
-//           column number) is used.
-//           See the project spec for details on computing the minimal seam.
-// NOTE:     You should compute the seam in reverse order, starting
-//           with the bottom of the image and proceeding to the top,
-//           as described in the project spec.
-void find_minimal_vertical_seam(const Matrix* cost, int seam[]) {
-  int column = Matrix_column_of_min_value_in_row(cost, Matrix_height(cost) - 1, 0, Matrix_width(cost));
-  seam[Matrix_height(cost) - 1] = column;
+//           The horizontal seam with the minimal cost is found and the
+//           seam array is filled with the row numbers for each pixel along
+//           the seam, with the pixel for each column c placed at seam[c].
+//           The seam starts at the cheapest pixel of the first column and
+//           proceeds right. If any pixels tie for lowest cost, the topmost
+//           one (i.e. with the lowest row number) is used.
+void find_minimal_horizontal_seam(const Matrix* cost, int seam[]) {
+  const int width = Matrix_width(cost);
+  const int height = Matrix_height(cost);
+  INSTRUMENT_SCOPE(STAGE_BACKTRACK, width);
 
-  for (int r = Matrix_height(cost) - 1; r > 0; --r){
-    int column_start = column - 1; // column inclusive
-    int column_end = column + 2; // column exclusive
-    
-    if (column_start < 0) {
-        column_start = 0;
+  int row = 0;
+  for (int r = 1; r < height; ++r) {
+    if (Matrix_row_span(cost, r)[0] < Matrix_row_span(cost, row)[0]) {
+      row = r;
     }
-    if (column_end > Matrix_width(cost)) {
-        column_end = Matrix_width(cost);
-    } 
+  }
+  seam[0] = row;
 
-    column = Matrix_column_of_min_value_in_row(cost, r - 1, column_start, column_end);
-    seam[r - 1] = column;  
+  for (int c = 1; c < width; ++c) {
+    const int row_start = max(row - 1, 0); // row inclusive
+    const int row_end = min(row + 1, height - 1); // row inclusive
+    row = row_start;
+    for (int r = row_start + 1; r <= row_end; ++r) {
+      if (Matrix_row_span(cost, r)[c] < Matrix_row_span(cost, row)[c]) {
+        row = r;
+      }
+    }
+    seam[c] = row;
   }
 }
 
-
-// REQUIRES: img points to a valid Image with width >= 2
+// REQUIRES: img points to a valid Image
+//           Image_height(img) >= 2
 //           seam points to an array
-//           the size of seam is == Image_height(img)
-//           each element x in seam satisfies 0 <= x < Image_width(img)
+//           the size of seam is == Image_width(img)
+//           each element x in seam satisfies 0 <= x < Image_height(img)
 // MODIFIES: *img
-// EFFECTS:  Removes the given vertical seam from the Image. That is, one
-//           pixel will be removed from every row in the image. The pixel
-//           removed from row r will be the one with column equal to seam[r].
-//           The width of the image will be one less than before.
-//           See the project spec for details on removing a vertical seam.
-// NOTE:     Use the new operator here to create the smaller Image,
-//           and then use delete when you are done with it.
-void remove_vertical_seam(Image *img, const int seam[]) {
-  assert(Image_width(img) >= 2);
-  Image *aux = new Image; // create a Image in dynamic memory
-  
-  Image_init(aux, Image_width(img) - 1, Image_height(img));
-
-  for (int r = 0; r < Image_height(img); ++r) {
-    assert(0 <= seam[r] && seam[r] < Image_width(img));
-    for (int c = 0; c < Image_width(img); ++c) {
-      if (c < seam[r]){
-        Image_set_pixel(aux, r, c, Image_get_pixel(img, r, c));
-      }else if (c > seam[r]){
-        Image_set_pixel(aux, r, c - 1, Image_get_pixel(img, r, c));   
+// EFFECTS:  Removes the given horizontal seam from the Image in place. The
+//           pixel removed from column c will be the one with row equal to
+//           seam[c], and the pixels below it move up one row. The height
+//           of the image will be one less than before.
+void remove_horizontal_seam(Image *img, const int seam[]) {
+  assert(Image_height(img) >= 2);
+  INSTRUMENT_SCOPE(STAGE_REMOVAL, static_cast<long long>(Image_width(img)) * Image_height(img));
+  for_each_pixel_matrix(img, [&](auto* mat) {
+    Matrix_remove_horizontal_seam(mat, seam);
+  });
+  img->height = Image_height(img) - 1;
+}
+
+
+// REQUIRES: carver points to a Seam_carver
+// MODIFIES: *carver
+// EFFECTS:  Initializes the Seam_carver with no scratch space yet.
+void Seam_carver_init(Seam_carver* carver) {
+  carver->allocations = 0;
+  carver->border_energy = MAX_ENERGY;
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+// EFFECTS:  Returns how many times the scratch space of the Seam_carver
+//           has grown.
+int Seam_carver_allocations(const Seam_carver* carver) {
+  return carver->allocations;
+}
+
+// MODIFIES: *carver, *buffer
+// EFFECTS:  Makes sure buffer can hold size elements without growing,
+//           counting an allocation if it has to grow now.
+template <typename T>
+static void Seam_carver_reserve(Seam_carver* carver, vector<T>* buffer,
+                                size_t size) {
+  if (buffer->capacity() < size) {
+    buffer->reserve(size);
+    ++carver->allocations;
+    INSTRUMENT_COUNT(COUNTER_ALLOCATIONS, 1);
+  }
+}
+
+// MODIFIES: *carver, *mat
+// EFFECTS:  Same as Seam_carver_reserve, for a Matrix of width by height.
+static void Seam_carver_reserve(Seam_carver* carver, Matrix* mat, int width,
+                                int height) {
+  if (mat->capacity < width * height) {
+    Matrix_init(mat, width, height);
+    ++carver->allocations;
+    INSTRUMENT_COUNT(COUNTER_ALLOCATIONS, 1);
+  }
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           seams_per_pass >= 1
+// MODIFIES: *carver
+// EFFECTS:  Grows the scratch space of carver, if needed, so carving img
+//           with up to seams_per_pass seams per pass allocates nothing.
+static void Seam_carver_prepare(Seam_carver* carver, const Image* img,
+                                int seams_per_pass) {
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  const size_t pixels = static_cast<size_t>(width) * height;
+  Seam_carver_reserve(carver, &carver->tracker.energy, width, height);
+  Seam_carver_reserve(carver, &carver->tracker.counts, MAX_ENERGY + 1);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED) {
+    Seam_carver_reserve(carver, &carver->tracker.scratch,
+                        num_bands(height - 2) * Planar_window_size(width));
+  }
+  Seam_carver_reserve(carver, &carver->cost, width, height);
+  if (get_seam_dp_mode() == SEAM_DP_BACKPOINTERS) {
+    Seam_carver_reserve(carver, &carver->backpointers.directions, pixels);
+    Seam_carver_reserve(carver, &carver->backpointers.last_row_costs, width);
+    Seam_carver_reserve(carver, &carver->backpointers.previous_row_costs, width);
+  }
+  Seam_carver_reserve(carver, &carver->seams,
+                      static_cast<size_t>(seams_per_pass) * max(width, height));
+  if (seams_per_pass > 1) {
+    Seam_carver_reserve(carver, &carver->energy_rows, width);
+    Seam_carver_reserve(carver, &carver->seam_starts, width);
+    Seam_carver_reserve(carver, &carver->claimed, pixels);
+  }
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth && newWidth <= Image_width(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Does the work of seam_carve_width. If on_seam isn't empty, it
+//           is called with each seam just before the seam is removed.
+static void carve_width(Seam_carver* carver, Image *img, int newWidth,
+                        const function<void(const int*)>& on_seam) {
+  assert(0 < newWidth && newWidth <= Image_width(img));
+  INSTRUMENT_SCOPE(STAGE_CARVE_WIDTH, 0);
+  Seam_carver_prepare(carver, img, 1);
+  Energy_tracker *tracker = &carver->tracker;
+  Matrix *cost = &carver->cost;
+
+  carver->seams.resize(Image_height(img));
+  int* seam = carver->seams.data();
+
+  if (get_seam_dp_mode() == SEAM_DP_BACKPOINTERS) {
+    // The energy matrix is kept up to date, but the cost matrix is never
+    // stored: each seam is found from freshly computed backpointers.
+    Seam_backpointers *backpointers = &carver->backpointers;
+    if (Image_width(img) != newWidth) {
+      Energy_tracker_init(tracker, img);
+    }
+    while (Image_width(img) != newWidth) {
+      compute_vertical_seam_backpointers(&tracker->energy, backpointers);
+      find_minimal_vertical_seam(backpointers, seam);
+      if (on_seam) {
+        on_seam(seam);
       }
+      remove_vertical_seam(img, seam);
+      Energy_tracker_remove_seam(tracker, img, seam);
+    }
+    return;
+  }
+
+  // The energy and cost matrices are computed once, then updated around
+  // each removed seam instead of being recomputed from scratch.
+  if (Image_width(img) != newWidth) {
+    Energy_tracker_init(tracker, img);
+    compute_vertical_cost_matrix(&tracker->energy, cost);
+  }
+  while (Image_width(img) != newWidth) {
+    find_minimal_vertical_seam(cost, seam);
+    if (on_seam) {
+      on_seam(seam);
     }
+    remove_vertical_seam(img, seam);
+    Energy_tracker_remove_seam(tracker, img, seam);
+    update_vertical_cost_matrix(&tracker->energy, cost, seam);
   }
-  *img = *aux;
-  
-  delete aux; // delete the Image
 }
 
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_width(img, newWidth), using the scratch
+//           space of carver.
+void Seam_carver_carve_width(Seam_carver* carver, Image *img, int newWidth) {
+  // Counted here rather than in carve_width, which also carves the
+  // scratch copy Seam_order_init records, so a cache miss counts the
+  // seams once, in Seam_order_carve.
+  INSTRUMENT_COUNT(COUNTER_SEAMS_REMOVED, Image_width(img) - newWidth);
+  carve_width(carver, img, newWidth, nullptr);
+}
 
 // REQUIRES: img points to a valid Image
 //           0 < newWidth && newWidth <= Image_width(img)
@@ -229,21 +1950,181 @@ void remove_vertical_seam(Image *img, const int seam[]) {
 // NOTE:     Use the new operator here to create Matrix objects, and
 //           then use delete when you are done with them.
 void seam_carve_width(Image *img, int newWidth) {
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+  Seam_carver_carve_width(carver, img, newWidth);
+  delete carver; // delete the Seam_carver
+}
+
+// Approximate batch carving: several seams are taken from every cost
+// matrix instead of one. The first seam of each batch is the exact
+// minimal seam; the others are the cheapest seams that neither share a
+// pixel with nor cross the seams already claimed, so the result can
+// differ from seam_carve_width.
+
+// REQUIRES: same as find_disjoint_vertical_seams
+//           starts and claimed_elements point to vectors
+// MODIFIES: seams, *starts, *claimed_elements
+// EFFECTS:  Same as find_disjoint_vertical_seams(cost, max_seams,
+//           max_cost_ratio, seams), keeping its bookkeeping in starts and
+//           claimed_elements, which are reused rather than allocated when
+//           they are big enough.
+static int find_disjoint_vertical_seams(const Matrix* cost, int max_seams,
+                                        double max_cost_ratio, int seams[],
+                                        vector<int>* starts,
+                                        vector<char>* claimed_elements) {
+  assert(max_seams >= 1);
+  assert(max_cost_ratio >= 1);
+  INSTRUMENT_SCOPE(STAGE_BACKTRACK, static_cast<long long>(Matrix_width(cost)) * Matrix_height(cost));
+  const int width = Matrix_width(cost);
+  const int height = Matrix_height(cost);
+
+  // Bottom elements from cheapest to most expensive, leftmost first on
+  // ties, so the first seam traced is the exact minimal seam. The
+  // tie-break on the column makes a plain sort stable without the buffer
+  // stable_sort would allocate.
+  starts->resize(width);
+  for (int c = 0; c < width; ++c) {
+    (*starts)[c] = c;
+  }
+  const int* bottom = Matrix_row_span(cost, height - 1).data;
+  sort(starts->begin(), starts->end(), [bottom](int a, int b) {
+    return bottom[a] < bottom[b] || (bottom[a] == bottom[b] && a < b);
+  });
+
+  claimed_elements->assign(static_cast<size_t>(width) * height, 0);
+  vector<char>& claimed = *claimed_elements;
+  auto is_claimed = [&](int r, int c) {
+    return claimed[static_cast<size_t>(r) * width + c] != 0;
+  };
+  const double max_cost = max_cost_ratio * bottom[(*starts)[0]];
+  int found = 0;
+  for (int start : *starts) {
+    if (found == max_seams) {
+      break;
+    }
+    if (found > 0 && !isinf(max_cost_ratio) && bottom[start] > max_cost) {
+      break;
+    }
+    int* seam = seams + static_cast<size_t>(found) * height;
+    seam[height - 1] = start;
+    bool blocked = false;
+    for (int r = height - 1; r > 0 && !blocked; --r) {
+      const int column = seam[r];
+      const Matrix_span<const int> above = Matrix_row_span(cost, r - 1);
+      int best = -1;
+      for (int c = max(column - 1, 0); c <= min(column + 1, width - 1); ++c) {
+        // A diagonal step crosses any seam that steps the opposite way
+        // between the same two rows.
+        const bool crosses = c != column && is_claimed(r - 1, column) && is_claimed(r, c);
+        if (is_claimed(r - 1, c) || crosses) {
+          continue;
+        }
+        if (best == -1 || above[c] < above[best]) {
+          best = c;
+        }
+      }
+      blocked = best == -1;
+      seam[r - 1] = best;
+    }
+    if (blocked) {
+      continue;
+    }
+    for (int r = 0; r < height; ++r) {
+      claimed[static_cast<size_t>(r) * width + seam[r]] = 1;
+    }
+    ++found;
+  }
+  return found;
+}
+
+// REQUIRES: cost points to a valid Matrix
+//           max_seams >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+//           seams points to an array of max_seams * Matrix_height(cost) ints
+// MODIFIES: seams
+// EFFECTS:  Finds up to max_seams vertical seams that don't share or cross
+//           over any pixel, stored back to back, and returns how many were
+//           found (at least 1). See processing.h for details.
+int find_disjoint_vertical_seams(const Matrix* cost, int max_seams,
+                                 double max_cost_ratio, int seams[]) {
+  vector<int> starts;
+  vector<char> claimed;
+  return find_disjoint_vertical_seams(cost, max_seams, max_cost_ratio, seams,
+                                      &starts, &claimed);
+}
+
+// REQUIRES: img points to a valid Image
+//           0 < num_seams && num_seams < Image_width(img)
+//           seams holds num_seams seams as found by
+//           find_disjoint_vertical_seams for this Image
+// MODIFIES: *img
+// EFFECTS:  Removes all the seams, compacting each row of each channel
+//           once. The width of the image will be num_seams less than
+//           before.
+void remove_vertical_seams(Image *img, const int seams[], int num_seams) {
+  INSTRUMENT_SCOPE(STAGE_REMOVAL, static_cast<long long>(Image_width(img)) * Image_height(img));
+  for_each_pixel_matrix(img, [&](auto* mat) {
+    Matrix_remove_vertical_seams(mat, seams, num_seams);
+  });
+  img->width -= num_seams;
+}
+
+// REQUIRES: img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           seams_per_pass >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+// MODIFIES: *img
+// EFFECTS:  Reduces the width of the given Image to be newWidth, like
+//           seam_carve_width but approximately: each pass computes the
+//           energy and cost matrices once and removes up to
+//           seams_per_pass seams found by find_disjoint_vertical_seams.
+void seam_carve_width_batched(Image *img, int newWidth, int seams_per_pass,
+                              double max_cost_ratio) {
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+  Seam_carver_carve_width_batched(carver, img, newWidth, seams_per_pass,
+                                  max_cost_ratio);
+  delete carver; // delete the Seam_carver
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           seams_per_pass >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_width_batched(img, newWidth, seams_per_pass,
+//           max_cost_ratio), using the scratch space of carver.
+void Seam_carver_carve_width_batched(Seam_carver* carver, Image *img,
+                                     int newWidth, int seams_per_pass,
+                                     double max_cost_ratio) {
   assert(0 < newWidth && newWidth <= Image_width(img));
-  Matrix *energy = new Matrix; // create a Matrix in dynamic memory 
-  Matrix *cost = new Matrix;
+  assert(seams_per_pass >= 1);
+  if (seams_per_pass == 1) {
+    Seam_carver_carve_width(carver, img, newWidth);
+    return;
+  }
+  INSTRUMENT_SCOPE(STAGE_CARVE_WIDTH, 0);
+  INSTRUMENT_COUNT(COUNTER_SEAMS_REMOVED, Image_width(img) - newWidth);
+  Seam_carver_prepare(carver, img, seams_per_pass);
+  // Every pass starts from scratch, and the energies aren't needed past
+  // the cost matrix, so the tracker's energy matrix is just storage for
+  // when the stages can't be fused.
+  Matrix *energy = &carver->tracker.energy;
+  Matrix *cost = &carver->cost;
 
-  int seam[MAX_MATRIX_HEIGHT];
-  
   while (Image_width(img) != newWidth) {
-    compute_energy_matrix(img, energy);
-    compute_vertical_cost_matrix(energy, cost);
-    find_minimal_vertical_seam(cost, seam);
-    remove_vertical_seam(img, seam);
-  }  
-
-  delete energy; // delete the Matrix
-  delete cost;
+    const int max_seams = min(seams_per_pass, Image_width(img) - newWidth);
+    carver->seams.resize(static_cast<size_t>(max_seams) * Image_height(img));
+    compute_energy_and_cost_matrices(img, energy, cost, false, &carver->border_energy,
+                                     &carver->tracker.scratch, &carver->energy_rows);
+    const int num_seams = find_disjoint_vertical_seams(cost, max_seams, max_cost_ratio,
+                                                       carver->seams.data(),
+                                                       &carver->seam_starts,
+                                                       &carver->claimed);
+    remove_vertical_seams(img, carver->seams.data(), num_seams);
+  }
 }
 
 // REQUIRES: img points to a valid Image
@@ -252,12 +2133,44 @@ void seam_carve_width(Image *img, int newWidth) {
 // EFFECTS:  Reduces the height of the given Image to be newHeight.
 // NOTE:     This is equivalent to first rotating the Image 90 degrees left,
 //           then applying seam_carve_width(img, newHeight), then rotating
-//           90 degrees right.
+//           90 degrees right. The seams are found and removed natively, so
+//           the Image is never rotated.
 void seam_carve_height(Image *img, int newHeight) {
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+  Seam_carver_carve_height(carver, img, newHeight);
+  delete carver; // delete the Seam_carver
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newHeight <= Image_height(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_height(img, newHeight), using the scratch
+//           space of carver.
+void Seam_carver_carve_height(Seam_carver* carver, Image *img, int newHeight) {
   assert(0 < newHeight && newHeight <= Image_height(img));
-  rotate_left(img);
-  seam_carve_width(img, newHeight);
-  rotate_right(img);  
+  INSTRUMENT_SCOPE(STAGE_CARVE_HEIGHT, 0);
+  INSTRUMENT_COUNT(COUNTER_SEAMS_REMOVED, Image_height(img) - newHeight);
+  Seam_carver_prepare(carver, img, 1);
+  Energy_tracker *tracker = &carver->tracker;
+  Matrix *cost = &carver->cost;
+
+  carver->seams.resize(Image_width(img));
+  int* seam = carver->seams.data();
+
+  // Mirrors seam_carve_width with horizontal seams, so the Image never
+  // has to be rotated.
+  if (Image_height(img) != newHeight) {
+    Energy_tracker_init(tracker, img);
+    compute_horizontal_cost_matrix(&tracker->energy, cost);
+  }
+  while (Image_height(img) != newHeight) {
+    find_minimal_horizontal_seam(cost, seam);
+    remove_horizontal_seam(img, seam);
+    Energy_tracker_remove_horizontal_seam(tracker, img, seam);
+    update_horizontal_cost_matrix(&tracker->energy, cost, seam);
+  }
 }
 
 // REQUIRES: img points to a valid Image
@@ -271,6 +2184,463 @@ void seam_carve_height(Image *img, int newHeight) {
 void seam_carve(Image *img, int newWidth, int newHeight) {
   assert(0 < newWidth && newWidth <= Image_width(img));
   assert(0 < newHeight && newHeight <= Image_height(img));
-  seam_carve_width(img, newWidth);
-  seam_carve_height(img, newHeight);    
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+  Seam_carver_carve(carver, img, newWidth, newHeight);
+  delete carver; // delete the Seam_carver
+}
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           0 < newHeight <= Image_height(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve(img, newWidth, newHeight), using the
+//           scratch space of carver.
+void Seam_carver_carve(Seam_carver* carver, Image *img, int newWidth,
+                       int newHeight) {
+  assert(0 < newWidth && newWidth <= Image_width(img));
+  assert(0 < newHeight && newHeight <= Image_height(img));
+  Seam_carver_carve_width(carver, img, newWidth);
+  Seam_carver_carve_height(carver, img, newHeight);
+}
+
+// REQUIRES: order points to a Seam_order
+//           img points to a valid Image
+//           0 < min_width && min_width <= Image_width(img)
+// MODIFIES: *order
+// EFFECTS:  Carves a copy of img down to min_width with seam_carve_width
+//           and records in order the iteration at which each pixel of img
+//           was removed, and the key of img.
+void Seam_order_init(Seam_order* order, const Image* img, int min_width) {
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  assert(0 < min_width && min_width <= width);
+  order->min_width = min_width;
+  order->image_key = Seam_cache_key(img);
+  Matrix_init(&order->removed_at, width, height);
+  Matrix_fill(&order->removed_at, width - min_width);
+
+  // source_column maps each column of the carved Image back to the
+  // column of img it came from, and loses the same seams.
+  Matrix *source_column = new Matrix; // create a Matrix in dynamic memory
+  Matrix_init(source_column, width, height);
+  for (int r = 0; r < height; ++r) {
+    int* row = Matrix_row_span(source_column, r).data;
+    for (int c = 0; c < width; ++c) {
+      row[c] = c;
+    }
+  }
+
+  Image *carved = new Image(*img); // create an Image in dynamic memory
+  int iteration = 0;
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+  carve_width(carver, carved, min_width, [&](const int* seam) {
+    for (int r = 0; r < height; ++r) {
+      Matrix_row_span(&order->removed_at, r)[Matrix_row_span(source_column, r)[seam[r]]] = iteration;
+    }
+    Matrix_remove_vertical_seam(source_column, seam);
+    ++iteration;
+  });
+
+  delete carved; // delete the Image
+  delete carver; // delete the Seam_carver
+  delete source_column; // delete the Matrix
+}
+
+// REQUIRES: removed_at, source and target have the same height
+//           each row of target has room for the kept elements of source
+// MODIFIES: *target
+// EFFECTS:  Copies into each row of target, in order, the elements of the
+//           same row of source whose removed_at entry is >= first_kept.
+template <typename T>
+static void gather_kept_elements(const Matrix* removed_at, int first_kept,
+                                 const Basic_matrix<T>* source,
+                                 Basic_matrix<T>* target) {
+  const int width = Matrix_width(source);
+  for (int r = 0; r < Matrix_height(source); ++r) {
+    const Matrix_span<const int> removed_row = Matrix_row_span(removed_at, r);
+    const Matrix_span<const T> source_row = Matrix_row_span(source, r);
+    T* target_row = Matrix_row_span(target, r).data;
+    for (int c = 0; c < width; ++c) {
+      if (removed_row[c] >= first_kept) {
+        *target_row++ = source_row[c];
+      }
+    }
+  }
+}
+
+// REQUIRES: order was initialized from img
+//           out has room for the pixels of img kept when the pixels
+//           removed before iteration first_kept are gone, in the layout
+//           of img
+// MODIFIES: *out
+// EFFECTS:  Copies the kept pixels of img into out.
+static void gather_kept_pixels(const Seam_order* order, const Image* img,
+                               int first_kept, Image* out) {
+  INSTRUMENT_SCOPE(STAGE_REMOVAL, static_cast<long long>(Image_width(img)) * Image_height(img));
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED) {
+    gather_kept_elements(&order->removed_at, first_kept, &img->pixels, &out->pixels);
+    return;
+  }
+  gather_kept_elements(&order->removed_at, first_kept, &img->red_channel, &out->red_channel);
+  gather_kept_elements(&order->removed_at, first_kept, &img->green_channel, &out->green_channel);
+  gather_kept_elements(&order->removed_at, first_kept, &img->blue_channel, &out->blue_channel);
+}
+
+// REQUIRES: order was initialized from img
+//           order->min_width <= newWidth && newWidth <= Image_width(img)
+//           out points to an Image other than img
+// MODIFIES: *out
+// EFFECTS:  Initializes out to be img carved to newWidth, exactly as
+//           seam_carve_width(img, newWidth) would, by keeping each pixel
+//           that is removed no earlier than iteration
+//           Image_width(img) - newWidth. This is a single pass over img.
+void Seam_order_carve(const Seam_order* order, const Image* img,
+                      int newWidth, Image* out) {
+  const int width = Image_width(img);
+  const int height = Image_height(img);
+  assert(Matrix_width(&order->removed_at) == width);
+  assert(Matrix_height(&order->removed_at) == height);
+  assert(order->min_width <= newWidth && newWidth <= width);
+  assert(out != img);
+  INSTRUMENT_SCOPE(STAGE_CARVE_WIDTH, 0);
+  const int first_kept = width - newWidth;
+  INSTRUMENT_COUNT(COUNTER_SEAMS_REMOVED, first_kept);
+  Image_init(out, newWidth, height, Image_get_layout(img));
+  gather_kept_pixels(order, img, first_kept, out);
+}
+
+// Seam_order records start with this, then the little-endian uint32s
+// MIN_WIDTH, WIDTH and HEIGHT, the little-endian uint64 IMAGE_KEY, then
+// one byte giving the size of each element of removed_at (2 or 4).
+const char SEAM_ORDER_MAGIC[8] = {'S', 'E', 'A', 'M', 'O', 'R', 'D', '\x02'};
+const int SEAM_ORDER_HEADER_SIZE = sizeof(SEAM_ORDER_MAGIC) + 3 * 4 + 8 + 1;
+
+// MODIFIES: out[0]...out[size-1]
+// EFFECTS:  Writes value to out in little-endian order, in size bytes.
+static void put_little_endian(unsigned char* out, uint32_t value, int size) {
+  for (int i = 0; i < size; ++i) {
+    out[i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+// EFFECTS: Returns the little-endian value of size bytes at in.
+static uint32_t get_little_endian(const unsigned char* in, int size) {
+  uint32_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint32_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// REQUIRES: in holds width elements of Size bytes each
+//           seen has iterations + 1 elements, all 0
+// MODIFIES: row, seen
+// EFFECTS:  Decodes the elements into row, counting each value less than
+//           iterations in seen. Returns false if one is greater than
+//           iterations.
+template <int Size>
+static bool decode_removal_row(const unsigned char* in, int width,
+                               uint32_t iterations, int* row, vector<int>* seen) {
+  uint32_t largest = 0;
+  for (int c = 0; c < width; ++c) {
+    const uint32_t value = get_little_endian(in + static_cast<size_t>(c) * Size, Size);
+    largest = max(largest, value);
+    row[c] = static_cast<int>(value);
+  }
+  if (largest > iterations) {
+    return false;
+  }
+  // Most pixels are never removed, so they aren't counted: incrementing
+  // one counter for each of them would serialize the loop.
+  for (int c = 0; c < width; ++c) {
+    if (static_cast<uint32_t>(row[c]) < iterations) {
+      ++(*seen)[row[c]];
+    }
+  }
+  return true;
+}
+
+// REQUIRES: order points to a valid Seam_order
+// MODIFIES: os
+// EFFECTS:  Writes the Seam_order to os in binary: SEAM_ORDER_MAGIC, the
+//           header and the rows of removed_at as fixed-width
+//           little-endian integers, 2 bytes each if every iteration fits
+//           and 4 otherwise. os should be opened in binary mode.
+void Seam_order_write(const Seam_order* order, std::ostream& os) {
+  const int width = Matrix_width(&order->removed_at);
+  const int height = Matrix_height(&order->removed_at);
+  INSTRUMENT_SCOPE(STAGE_ORDER_IO, static_cast<long long>(width) * height);
+  const int size = width - order->min_width <= 0xffff ? 2 : 4;
+  unsigned char header[SEAM_ORDER_HEADER_SIZE];
+  memcpy(header, SEAM_ORDER_MAGIC, sizeof(SEAM_ORDER_MAGIC));
+  put_little_endian(header + 8, order->min_width, 4);
+  put_little_endian(header + 12, width, 4);
+  put_little_endian(header + 16, height, 4);
+  put_little_endian(header + 20, static_cast<uint32_t>(order->image_key), 4);
+  put_little_endian(header + 24, static_cast<uint32_t>(order->image_key >> 32), 4);
+  header[28] = static_cast<unsigned char>(size);
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  vector<unsigned char> row_bytes(static_cast<size_t>(width) * size);
+  for (int r = 0; r < height; ++r) {
+    const Matrix_span<const int> row = Matrix_row_span(&order->removed_at, r);
+    for (int c = 0; c < width; ++c) {
+      put_little_endian(&row_bytes[static_cast<size_t>(c) * size], row[c], size);
+    }
+    os.write(reinterpret_cast<const char*>(row_bytes.data()), row_bytes.size());
+  }
+}
+
+// REQUIRES: order points to a Seam_order
+//           is holds at most record_size bytes from its position
+// MODIFIES: *order, is
+// EFFECTS:  Reads a Seam_order written by Seam_order_write from is, one
+//           row of elements at a time. Returns false, leaving *order
+//           unspecified, if the input is malformed, its header claims more
+//           elements than record_size bytes can hold, or it isn't a
+//           consistent removal order (every row must remove exactly one
+//           pixel at each iteration).
+bool Seam_order_read(Seam_order* order, std::istream& is,
+                     std::uintmax_t record_size) {
+  INSTRUMENT_SCOPE(STAGE_ORDER_IO, 0);
+  unsigned char header[SEAM_ORDER_HEADER_SIZE];
+  if (!is.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      memcmp(header, SEAM_ORDER_MAGIC, sizeof(SEAM_ORDER_MAGIC)) != 0) {
+    return false;
+  }
+  const uint32_t min_width = get_little_endian(header + 8, 4);
+  const uint32_t width = get_little_endian(header + 12, 4);
+  const uint32_t height = get_little_endian(header + 16, 4);
+  const uint64_t image_key = get_little_endian(header + 20, 4) |
+                             static_cast<uint64_t>(get_little_endian(header + 24, 4)) << 32;
+  const int size = header[28];
+  if (width == 0 || height == 0 || min_width == 0 || min_width > width ||
+      width > INT_MAX / height || (size != 2 && size != 4)) {
+    return false;
+  }
+  // Checked before anything is allocated, so a corrupt header can't ask
+  // for more memory than the record itself takes.
+  const size_t row_size = static_cast<size_t>(width) * size;
+  const uintmax_t header_size = SEAM_ORDER_HEADER_SIZE;
+  if (record_size < header_size || (record_size - header_size) / row_size < height) {
+    return false;
+  }
+  order->min_width = static_cast<int>(min_width);
+  order->image_key = image_key;
+  INSTRUMENT_SCOPE_PIXELS(static_cast<long long>(width) * height);
+  Matrix_init(&order->removed_at, width, height);
+
+  // seen[i] counts the pixels of the current row removed at iteration i.
+  const uint32_t iterations = width - min_width;
+  vector<int> seen(iterations + 1);
+  vector<unsigned char> row_bytes(row_size);
+  for (uint32_t r = 0; r < height; ++r) {
+    fill(seen.begin(), seen.end(), 0);
+    if (!is.read(reinterpret_cast<char*>(row_bytes.data()), row_size)) {
+      return false;
+    }
+    const unsigned char* in = row_bytes.data();
+    int* row = Matrix_row_span(&order->removed_at, r).data;
+    const bool decoded = size == 2
+        ? decode_removal_row<2>(in, width, iterations, row, &seen)
+        : decode_removal_row<4>(in, width, iterations, row, &seen);
+    if (!decoded) {
+      return false;
+    }
+    for (uint32_t i = 0; i < iterations; ++i) {
+      if (seen[i] != 1) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// EFFECTS: Returns an id of this process, used to name temporary files.
+static long process_id() {
+#if defined(__unix__) || defined(__APPLE__)
+  return static_cast<long>(getpid());
+#else
+  return 0;
+#endif
+}
+
+// REQUIRES: cache points to a Seam_cache
+// MODIFIES: *cache, the file system
+// EFFECTS:  Initializes an empty set of counters for the cache in the given
+//           directory, creating the directory if needed. Records are
+//           evicted to keep the cache within max_bytes.
+void Seam_cache_init(Seam_cache* cache, const std::string& directory,
+                     std::uintmax_t max_bytes) {
+  cache->directory = directory;
+  cache->max_bytes = max_bytes;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  error_code error;
+  filesystem::create_directories(directory, error);
+}
+
+// REQUIRES: img points to a valid Image
+// EFFECTS:  Returns the hash of the size and pixels of img, combined with
+//           SEAM_ORDER_VERSION, that Seam_cache uses as the key of img.
+// NOTE:     This is 64-bit FNV-1a over 8-byte words rather than bytes,
+//           which is plenty to tell images apart and runs at memory speed.
+//           The words are assembled little-endian, so the key, and the
+//           name of the record, is the same on every host.
+std::uint64_t Seam_cache_key(const Image* img) {
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&](uint64_t value) {
+    hash = (hash ^ value) * prime;
+  };
+  auto mix_bytes = [&](const uint8_t* bytes, int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+      // Compilers turn this into a single load on little-endian hosts.
+      uint64_t word = 0;
+      for (int b = 0; b < 8; ++b) {
+        word |= static_cast<uint64_t>(bytes[i + b]) << (8 * b);
+      }
+      mix(word);
+    }
+    for (; i < size; ++i) {
+      mix(bytes[i]);
+    }
+  };
+  mix(SEAM_ORDER_VERSION);
+  mix(Image_width(img));
+  mix(Image_height(img));
+  // Channel after channel whatever the layout, so the key doesn't depend
+  // on it.
+  const int width = Image_width(img);
+  if (Image_get_layout(img) == IMAGE_INTERLEAVED) {
+    const uint8_t Byte_rgb::* const members[3] = {&Byte_rgb::r, &Byte_rgb::g, &Byte_rgb::b};
+    vector<uint8_t> channel_row(width);
+    for (const auto member : members) {
+      for (int r = 0; r < Image_height(img); ++r) {
+        const Matrix_span<const Byte_rgb> row = Image_pixel_row(img, r);
+        for (int c = 0; c < width; ++c) {
+          channel_row[c] = row[c].*member;
+        }
+        mix_bytes(channel_row.data(), width);
+      }
+    }
+    return hash;
+  }
+  for (Image_channel channel : {IMAGE_RED, IMAGE_GREEN, IMAGE_BLUE}) {
+    for (int r = 0; r < Image_height(img); ++r) {
+      mix_bytes(Image_channel_row(img, channel, r).data, width);
+    }
+  }
+  return hash;
+}
+
+// EFFECTS: Returns the path of the record for the given key.
+static filesystem::path Seam_cache_path(const Seam_cache* cache, uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.seams", static_cast<unsigned long long>(key));
+  return filesystem::path(cache->directory) / name;
+}
+
+// MODIFIES: *cache, the file system
+// EFFECTS:  Deletes the least recently used records, other than keep,
+//           until the records take at most cache->max_bytes.
+static void Seam_cache_evict(Seam_cache* cache, const filesystem::path& keep) {
+  struct Record {
+    filesystem::file_time_type last_used;
+    uintmax_t size;
+    filesystem::path path;
+  };
+  vector<Record> records;
+  uintmax_t total = 0;
+  error_code error;
+  for (const filesystem::directory_entry& entry :
+       filesystem::directory_iterator(cache->directory, error)) {
+    if (entry.path().extension() != ".seams") {
+      continue;
+    }
+    error_code time_error;
+    error_code size_error;
+    Record record = {entry.last_write_time(time_error), entry.file_size(size_error),
+                     entry.path()};
+    if (!time_error && !size_error) {
+      total += record.size;
+      records.push_back(record);
+    }
+  }
+  sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+    return a.last_used < b.last_used;
+  });
+  for (const Record& record : records) {
+    if (total <= cache->max_bytes) {
+      break;
+    }
+    if (record.path != keep && filesystem::remove(record.path, error)) {
+      total -= record.size;
+      ++cache->evictions;
+    }
+  }
+}
+
+// REQUIRES: cache was initialized by Seam_cache_init
+//           order points to a Seam_order
+//           img points to a valid Image
+//           0 < min_width && min_width <= Image_width(img)
+// MODIFIES: *cache, *order, the file system
+// EFFECTS:  Fills order with a Seam_order of img that goes down to
+//           min_width or further, from the cache if it holds one.
+void Seam_cache_get(Seam_cache* cache, Seam_order* order, const Image* img,
+                    int min_width) {
+  INSTRUMENT_SCOPE(STAGE_SEAM_CACHE, 0);
+  const uint64_t key = Seam_cache_key(img);
+  const filesystem::path path = Seam_cache_path(cache, key);
+  error_code error;
+  {
+    ifstream fin(path, ios::binary);
+    const uintmax_t record_size = filesystem::file_size(path, error);
+    if (fin.is_open() && !error && Seam_order_read(order, fin, record_size)
+        && order->image_key == key
+        && Matrix_width(&order->removed_at) == Image_width(img)
+        && Matrix_height(&order->removed_at) == Image_height(img)
+        && order->min_width <= min_width) {
+      // The modification time doubles as the last use for eviction.
+      filesystem::last_write_time(path, filesystem::file_time_type::clock::now(), error);
+      ++cache->hits;
+      return;
+    }
+  }
+
+  ++cache->misses;
+  Seam_order_init(order, img, min_width);
+
+  // Written under a name unique to this process, then renamed into place.
+  filesystem::path temporary = path;
+  temporary += ".tmp" + to_string(process_id());
+  {
+    ofstream fout(temporary, ios::binary);
+    Seam_order_write(order, fout);
+    if (!fout) {
+      fout.close();
+      filesystem::remove(temporary, error);
+      return;
+    }
+  }
+  filesystem::rename(temporary, path, error);
+  if (error) {
+    filesystem::remove(temporary, error);
+    return;
+  }
+  Seam_cache_evict(cache, path);
+}
+
+// REQUIRES: cache points to a valid Seam_cache
+// MODIFIES: os
+// EFFECTS:  Prints the hit, miss and eviction counts of the cache.
+void Seam_cache_print_stats(const Seam_cache* cache, std::ostream& os) {
+  os << "seam cache: " << cache->hits << " hits, " << cache->misses
+     << " misses, " << cache->evictions << " evictions" << endl;
 }
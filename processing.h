@@ -1,9 +1,41 @@
 #ifndef PROCESSING_H
 #define PROCESSING_H
 
+#include <cstdint>
+#include <string>
+#include <vector>
 #include "Matrix.h"
 #include "Image.h"
 
+// Instruction sets the vectorized processing kernels can use, from least
+// to most capable. Results never depend on which one is used.
+enum Simd_level { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+
+// EFFECTS: Returns the most capable Simd_level this CPU supports.
+Simd_level simd_level_supported();
+
+// REQUIRES: level <= simd_level_supported()
+// MODIFIES: the instruction set used by the processing kernels
+// EFFECTS:  Makes the processing kernels use the given instruction set.
+//           By default, the most capable supported one is used.
+void set_simd_level(Simd_level level);
+
+// EFFECTS: Returns the instruction set used by the processing kernels.
+Simd_level get_simd_level();
+
+// REQUIRES: num_threads >= 1
+//           no processing function is running
+// MODIFIES: the threads used by the processing functions
+// EFFECTS:  Makes the processing functions use num_threads threads,
+//           counting the calling thread. The num_threads - 1 worker threads
+//           are started here and reused by every later call, so no threads
+//           are created per seam. The default is 1 (no worker threads).
+//           Results never depend on the number of threads.
+void set_num_threads(int num_threads);
+
+// EFFECTS: Returns the number of threads used by the processing functions.
+int get_num_threads();
+
 // REQUIRES: img points to a valid Image
 // MODIFIES: *img
 // EFFECTS:  The image is rotated 90 degrees to the left (counterclockwise).
@@ -14,6 +46,23 @@ void rotate_left(Image* img);
 // EFFECTS:  The image is rotated 90 degrees to the right (clockwise).
 void rotate_right(Image* img);
 
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is rotated 180 degrees.
+void rotate_180(Image* img);
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is mirrored left to right: the pixel at row r,
+//           column c moves to row r, column Image_width(img) - 1 - c.
+void flip_horizontal(Image* img);
+
+// REQUIRES: img points to a valid Image
+// MODIFIES: *img
+// EFFECTS:  The image is mirrored top to bottom: the pixel at row r,
+//           column c moves to row Image_height(img) - 1 - r, column c.
+void flip_vertical(Image* img);
+
 // REQUIRES: img points to a valid Image.
 //           energy points to a Matrix.
 // MODIFIES: *energy
@@ -22,6 +71,10 @@ void rotate_right(Image* img);
 //           size as the given Image, and then the energy matrix for that
 //           image is computed and written into it.
 //           See the project spec for details on computing the energy matrix.
+// NOTE:     Whole rows are computed at a time by the vectorized kernel for
+//           the current Simd_level, which also tracks the maximum energy.
+//           With more than one thread (see set_num_threads), the rows are
+//           split into bands computed concurrently.
 void compute_energy_matrix(const Image* img, Matrix* energy);
 
 // REQUIRES: energy points to a valid Matrix.
@@ -33,8 +86,55 @@ void compute_energy_matrix(const Image* img, Matrix* energy);
 //           size as the given energy Matrix, and then the cost matrix is
 //           computed and written into it.
 //           See the project spec for details on computing the cost matrix.
+// NOTE:     Whole rows are computed at a time by the vectorized kernel for
+//           the current Simd_level. With more than one thread (see
+//           set_num_threads) and a wide enough matrix, tiles of rows and
+//           columns are computed concurrently in a wavefront instead.
 void compute_vertical_cost_matrix(const Matrix* energy, Matrix *cost);
 
+// Largest energy a pixel can have: two squared differences of at most
+// 3 * MAX_INTENSITY^2 / 100 each.
+const int MAX_ENERGY = 2 * (3 * MAX_INTENSITY * MAX_INTENSITY / 100);
+
+// REQUIRES: img points to a valid Image
+//           energy is null or points to a Matrix other than cost
+//           cost points to a Matrix
+//           border_energy points to an int
+// MODIFIES: *energy, *cost, *border_energy
+// EFFECTS:  Computes the vertical cost matrix of img into cost, exactly as
+//           compute_energy_matrix followed by compute_vertical_cost_matrix
+//           would, and the energy matrix into energy unless it is null.
+//           *border_energy is a guess of the border energy on entry, and
+//           is set to the real one.
+// NOTE:     Without energy, each energy row is folded into the cost matrix
+//           as soon as it is computed, so the energy matrix is never
+//           written to memory and read back. The border energy (the
+//           largest of the others) is needed from row 0 on but only known
+//           at the end, so the pass assumes the guess. A guess that was
+//           too high costs one more pass over the cost matrix; one that was
+//           too low, a second fused pass. MAX_ENERGY is never too low, and
+//           the border energy of the same Image before a few seams were
+//           removed is usually exact.
+void compute_energy_and_cost_matrices(const Image* img, Matrix* energy, Matrix* cost,
+                                      int* border_energy);
+
+// REQUIRES: energy points to a valid Matrix, obtained by removing the
+//           given vertical seam from an energy matrix E and then updating
+//           it as Energy_tracker_remove_seam does: away from the border,
+//           elements differ from E only within one column of the seam
+//           in the same row or the rows above and below, and the border
+//           holds a single value.
+//           cost points to the cost matrix of E
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  Updates cost to be the cost matrix of energy. The old costs are
+//           shifted along with the seam and only the cells that can have
+//           changed are recomputed: a band around the seam plus, row by
+//           row, the neighbors of cells that actually changed in the row
+//           above. The result is identical to compute_vertical_cost_matrix.
+void update_vertical_cost_matrix(const Matrix* energy, Matrix* cost,
+                                 const int seam[]);
+
 // REQUIRES: cost points to a valid Matrix
 //           seam points to an array
 //           the size of seam is >= Matrix_height(cost)
@@ -61,8 +161,152 @@ void find_minimal_vertical_seam(const Matrix* cost, int seam[]);
 //           removed from row r will be the one with column equal to seam[r].
 //           The width of the image will be one less than before.
 //           See the project spec for details on removing a vertical seam.
+// NOTE:     The seam is removed in place: each row of each channel is
+//           compacted with a single memmove and no Image is allocated.
+//           With more than one thread (see set_num_threads), bands of rows
+//           are compacted concurrently on the shared thread pool.
 void remove_vertical_seam(Image *img, const int seam[]);
 
+// Keeps the energy matrix of an Image up to date while vertical seams are
+// removed from it, without recomputing the whole matrix for every seam.
+// counts[e] is the number of non-border elements whose energy is e, which
+// lets the border value (the maximum energy) be maintained without
+// rescanning the matrix.
+struct Energy_tracker {
+  Matrix energy;
+  std::vector<int> counts;
+  int max_energy;
+  std::vector<uint8_t> scratch;  // rows of interleaved Images being split
+};
+
+// REQUIRES: tracker points to an Energy_tracker
+//           img points to a valid Image
+// MODIFIES: *tracker
+// EFFECTS:  Computes the energy matrix of img into tracker->energy, exactly
+//           as compute_energy_matrix does, and starts tracking it.
+void Energy_tracker_init(Energy_tracker* tracker, const Image* img);
+
+// REQUIRES: tracker was initialized with an Image that has since had
+//           exactly one vertical seam removed, giving img
+//           seam is the seam that was removed
+// MODIFIES: *tracker
+// EFFECTS:  Updates tracker->energy to be the energy matrix of img. The
+//           old energies are shifted along with the seam and only the
+//           elements next to it are recomputed. The result is identical
+//           to calling compute_energy_matrix(img, &tracker->energy).
+void Energy_tracker_remove_seam(Energy_tracker* tracker, const Image* img,
+                                const int seam[]);
+
+// REQUIRES: tracker was initialized with an Image that has since had
+//           exactly one horizontal seam removed, giving img
+//           seam is the seam that was removed
+// MODIFIES: *tracker
+// EFFECTS:  Same as Energy_tracker_remove_seam, for a horizontal seam.
+void Energy_tracker_remove_horizontal_seam(Energy_tracker* tracker,
+                                           const Image* img,
+                                           const int seam[]);
+
+// The backpointers of a vertical seam search, an alternative to keeping
+// the whole cost matrix. directions holds, for each element (row-major,
+// width per row), the column offset (-1, 0 or +1) of the element above it
+// with the minimal cost, the leftmost on ties. Only the last row of costs
+// is kept, in last_row_costs; previous_row_costs is scratch space.
+struct Seam_backpointers {
+  int width;
+  int height;
+  std::vector<int8_t> directions;
+  std::vector<int> last_row_costs;
+  std::vector<int> previous_row_costs;
+};
+
+// REQUIRES: energy points to a valid Matrix
+//           backpointers points to a Seam_backpointers
+// MODIFIES: *backpointers
+// EFFECTS:  Runs the same dynamic program as compute_vertical_cost_matrix,
+//           but with two rolling rows of costs, and records the
+//           backpointers of every element instead of its cost. The
+//           buffers are reused from earlier calls.
+void compute_vertical_seam_backpointers(const Matrix* energy,
+                                        Seam_backpointers* backpointers);
+
+// REQUIRES: backpointers was computed by compute_vertical_seam_backpointers
+//           seam points to an array
+//           the size of seam is >= backpointers->height
+// MODIFIES: seam[0]...seam[backpointers->height-1]
+// EFFECTS:  Same as find_minimal_vertical_seam on the cost matrix of the
+//           same energy Matrix, but the seam is found by following one
+//           backpointer per row instead of rescanning the costs.
+void find_minimal_vertical_seam(const Seam_backpointers* backpointers,
+                                int seam[]);
+
+// How seam_carve_width finds its seams. SEAM_DP_COST_MATRIX (the default)
+// keeps the whole cost matrix and updates it around each removed seam.
+// SEAM_DP_BACKPOINTERS recomputes backpointers for every seam, but its
+// working set is one byte per pixel plus two rows instead of a full int
+// cost matrix. Both find the same seams.
+enum Seam_dp_mode { SEAM_DP_COST_MATRIX, SEAM_DP_BACKPOINTERS };
+
+// MODIFIES: the way seam_carve_width finds its seams
+// EFFECTS:  Makes seam_carve_width use the given Seam_dp_mode.
+void set_seam_dp_mode(Seam_dp_mode mode);
+
+// EFFECTS: Returns the Seam_dp_mode used by seam_carve_width.
+Seam_dp_mode get_seam_dp_mode();
+
+// Horizontal seams are found and removed natively, in the Image's own
+// orientation. They are exactly the seams seam_carve_width would find on
+// the Image rotated 90 degrees left: the cost of a pixel is the cost of
+// the cheapest path from it to the RIGHT edge, and ties go to the
+// topmost row.
+
+// REQUIRES: energy points to a valid Matrix.
+//           cost points to a Matrix.
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  cost serves as an "output parameter".
+//           The Matrix pointed to by cost is initialized to be the same
+//           size as the given energy Matrix. Each element in the last
+//           column gets its energy, and every other element gets its
+//           energy plus the minimal cost among the (up to three) elements
+//           in the next column in the rows above, equal and below.
+void compute_horizontal_cost_matrix(const Matrix* energy, Matrix *cost);
+
+// REQUIRES: energy points to a valid Matrix, obtained from an energy
+//           matrix E by the removal of the given horizontal seam as
+//           Energy_tracker_remove_horizontal_seam does.
+//           cost points to the horizontal cost matrix of E
+//           energy and cost aren't pointing to the same Matrix
+// MODIFIES: *cost
+// EFFECTS:  Same as update_vertical_cost_matrix, for a horizontal seam. The
+//           result is identical to compute_horizontal_cost_matrix.
+void update_horizontal_cost_matrix(const Matrix* energy, Matrix* cost,
+                                   const int seam[]);
+
+// REQUIRES: cost points to a valid horizontal cost Matrix
+//           seam points to an array
+//           the size of seam is >= Matrix_width(cost)
+// MODIFIES: seam[0]...seam[Matrix_width(cost)-1]
+// EFFECTS:  seam serves as an "output parameter".
+//           The horizontal seam with the minimal cost is found and the
+//           seam array is filled with the row numbers for each pixel along
+//           the seam, with the pixel for each column c placed at seam[c].
+//           The seam starts at the cheapest pixel of the first column and
+//           proceeds right. If any pixels tie for lowest cost, the topmost
+//           one (i.e. with the lowest row number) is used.
+void find_minimal_horizontal_seam(const Matrix* cost, int seam[]);
+
+// REQUIRES: img points to a valid Image
+//           Image_height(img) >= 2
+//           seam points to an array
+//           the size of seam is == Image_width(img)
+//           each element x in seam satisfies 0 <= x < Image_height(img)
+// MODIFIES: *img
+// EFFECTS:  Removes the given horizontal seam from the Image in place. The
+//           pixel removed from column c will be the one with row equal to
+//           seam[c], and the pixels below it move up one row. The height
+//           of the image will be one less than before.
+void remove_horizontal_seam(Image *img, const int seam[]);
+
 // REQUIRES: img points to a valid Image
 //           0 < newWidth <= Image_width(img)
 // MODIFIES: *img
@@ -70,13 +314,61 @@ void remove_vertical_seam(Image *img, const int seam[]);
 //           the seam carving algorithm. See the spec for details.
 void seam_carve_width(Image *img, int newWidth);
 
+// Approximate batch carving: several seams are taken from every cost
+// matrix instead of one. The first seam of each batch is the exact
+// minimal seam; the others are the cheapest seams that neither share a
+// pixel with nor cross the seams already claimed, so the result can
+// differ from seam_carve_width.
+
+// REQUIRES: cost points to a valid Matrix
+//           max_seams >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+//           seams points to an array of max_seams * Matrix_height(cost) ints
+// MODIFIES: seams
+// EFFECTS:  Finds up to max_seams vertical seams that don't share or cross
+//           over any pixel, stored back to back (seam i, row r is
+//           seams[i * Matrix_height(cost) + r]), and returns how many were
+//           found (at least 1). The first is the one
+//           find_minimal_vertical_seam finds. Each next one starts at the
+//           cheapest remaining bottom element and is traced back up
+//           through the cheapest unclaimed elements; seams that get
+//           blocked are skipped. Seams costing more than max_cost_ratio
+//           times the first aren't taken.
+int find_disjoint_vertical_seams(const Matrix* cost, int max_seams,
+                                 double max_cost_ratio, int seams[]);
+
+// REQUIRES: img points to a valid Image
+//           0 < num_seams && num_seams < Image_width(img)
+//           seams holds num_seams seams as found by
+//           find_disjoint_vertical_seams for this Image
+// MODIFIES: *img
+// EFFECTS:  Removes all the seams, compacting each row of each channel
+//           once. The width of the image will be num_seams less than
+//           before.
+void remove_vertical_seams(Image *img, const int seams[], int num_seams);
+
+// REQUIRES: img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           seams_per_pass >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+// MODIFIES: *img
+// EFFECTS:  Reduces the width of the given Image to be newWidth, like
+//           seam_carve_width but approximately: each pass computes the
+//           energy and cost matrices once and removes up to
+//           seams_per_pass seams found by find_disjoint_vertical_seams.
+//           With seams_per_pass == 1 the result is the same as
+//           seam_carve_width.
+void seam_carve_width_batched(Image *img, int newWidth, int seams_per_pass,
+                              double max_cost_ratio);
+
 // REQUIRES: img points to a valid Image
 //           0 < newHeight <= Image_height(img)
 // MODIFIES: *img
 // EFFECTS:  Reduces the height of the given Image to be newHeight.
 // NOTE:     This is equivalent to first rotating the Image 90 degrees left,
 //           then applying seam_carve_width(img, newHeight), then rotating
-//           90 degrees right.
+//           90 degrees right. The seams are found and removed natively, so
+//           the Image is never rotated.
 void seam_carve_height(Image *img, int newHeight);
 
 // REQUIRES: img points to a valid Image
@@ -89,5 +381,179 @@ void seam_carve_height(Image *img, int newHeight);
 //           and then applying seam_carve_height(img, newHeight).
 void seam_carve(Image *img, int newWidth, int newHeight);
 
+// A reusable seam carving context. It owns the scratch space carving
+// needs (the energy tracker, cost matrix, backpointers and seam buffers)
+// and keeps it from call to call, sized to the largest Image seen, so
+// carving many Images of similar size allocates only for the first one.
+// allocations counts the times the scratch space had to grow. The
+// seam_carve functions above each use a Seam_carver of their own.
+struct Seam_carver {
+  Energy_tracker tracker;
+  Matrix cost;
+  Seam_backpointers backpointers;
+  std::vector<int> energy_rows;  // the row of the fused energy and cost pass
+  int border_energy;             // border energy the next fused pass assumes
+  std::vector<int> seams;
+  std::vector<int> seam_starts;
+  std::vector<char> claimed;
+  int allocations;
+};
+
+// REQUIRES: carver points to a Seam_carver
+// MODIFIES: *carver
+// EFFECTS:  Initializes the Seam_carver with no scratch space yet.
+void Seam_carver_init(Seam_carver* carver);
+
+// REQUIRES: carver points to a valid Seam_carver
+// EFFECTS:  Returns how many times the scratch space of the Seam_carver
+//           has grown. It stays the same while carving Images no larger
+//           than one carved before; the carving loops themselves never
+//           allocate.
+int Seam_carver_allocations(const Seam_carver* carver);
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_width(img, newWidth), using the scratch
+//           space of carver.
+void Seam_carver_carve_width(Seam_carver* carver, Image *img, int newWidth);
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           seams_per_pass >= 1
+//           max_cost_ratio >= 1 (INFINITY for no limit)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_width_batched(img, newWidth, seams_per_pass,
+//           max_cost_ratio), using the scratch space of carver.
+void Seam_carver_carve_width_batched(Seam_carver* carver, Image *img,
+                                     int newWidth, int seams_per_pass,
+                                     double max_cost_ratio);
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newHeight <= Image_height(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve_height(img, newHeight), using the scratch
+//           space of carver.
+void Seam_carver_carve_height(Seam_carver* carver, Image *img, int newHeight);
+
+// REQUIRES: carver points to a valid Seam_carver
+//           img points to a valid Image
+//           0 < newWidth <= Image_width(img)
+//           0 < newHeight <= Image_height(img)
+// MODIFIES: *carver, *img
+// EFFECTS:  Same as seam_carve(img, newWidth, newHeight), using the
+//           scratch space of carver.
+void Seam_carver_carve(Seam_carver* carver, Image *img, int newWidth,
+                       int newHeight);
+
+// The order in which seam_carve_width removes the pixels of an Image,
+// which lets the Image be carved to any width down to min_width without
+// running the seam search again. removed_at has the size of the Image:
+// the element for a pixel is the (0-based) iteration at which
+// seam_carve_width removes it, or Image_width - min_width if it is never
+// removed on the way down to min_width. image_key is the Seam_cache_key
+// of the Image the order was recorded from, so a saved order is only
+// reused for that Image.
+struct Seam_order {
+  int min_width;
+  std::uint64_t image_key;
+  Matrix removed_at;
+};
+
+// REQUIRES: order points to a Seam_order
+//           img points to a valid Image
+//           0 < min_width && min_width <= Image_width(img)
+// MODIFIES: *order
+// EFFECTS:  Carves a copy of img down to min_width with seam_carve_width
+//           and records in order the iteration at which each pixel of img
+//           was removed, and the key of img.
+void Seam_order_init(Seam_order* order, const Image* img, int min_width);
+
+// REQUIRES: order was initialized from img
+//           order->min_width <= newWidth && newWidth <= Image_width(img)
+//           out points to an Image other than img
+// MODIFIES: *out
+// EFFECTS:  Initializes out to be img carved to newWidth, exactly as
+//           seam_carve_width(img, newWidth) would, by keeping each pixel
+//           that is removed no earlier than iteration
+//           Image_width(img) - newWidth. This is a single pass over img.
+void Seam_order_carve(const Seam_order* order, const Image* img,
+                      int newWidth, Image* out);
+
+// REQUIRES: order points to a valid Seam_order
+// MODIFIES: os
+// EFFECTS:  Writes the Seam_order to os in binary: a short header with
+//           min_width, the size of removed_at and image_key, then the elements of
+//           removed_at row by row as fixed-width little-endian integers.
+//           os should be opened in binary mode.
+void Seam_order_write(const Seam_order* order, std::ostream& os);
+
+// REQUIRES: order points to a Seam_order
+//           is holds at most record_size bytes from its position
+// MODIFIES: *order, is
+// EFFECTS:  Reads a Seam_order written by Seam_order_write from is.
+//           Returns false, leaving *order unspecified, if the input is
+//           malformed, its header claims more elements than record_size
+//           bytes can hold, or it isn't a consistent removal order (every
+//           row must remove exactly one pixel at each iteration).
+bool Seam_order_read(Seam_order* order, std::istream& is,
+                     std::uintmax_t record_size);
+
+// An on-disk cache of Seam_orders, so an Image that was carved before can
+// be carved again by a single Seam_order_carve pass. Records are stored
+// in directory, one file per Image, named after a hash of the Image's
+// pixels and SEAM_ORDER_VERSION. They are written to a temporary file
+// and renamed into place, so readers never see a partial record. When the
+// records take more than max_bytes, the least recently used ones are
+// deleted. hits, misses and evictions count what the cache has done.
+struct Seam_cache {
+  std::string directory;
+  std::uintmax_t max_bytes;
+  int hits;
+  int misses;
+  int evictions;
+};
+
+// Identifies the energy function and seam search that produced a cached
+// Seam_order. Changing either must change this, so old records are no
+// longer found.
+const int SEAM_ORDER_VERSION = 2;
+
+// REQUIRES: cache points to a Seam_cache
+// MODIFIES: *cache, the file system
+// EFFECTS:  Initializes an empty set of counters for the cache in the given
+//           directory, creating the directory if needed. Records are
+//           evicted to keep the cache within max_bytes.
+void Seam_cache_init(Seam_cache* cache, const std::string& directory,
+                     std::uintmax_t max_bytes);
+
+// REQUIRES: img points to a valid Image
+// EFFECTS:  Returns the hash of the size and pixels of img, combined with
+//           SEAM_ORDER_VERSION, that Seam_cache uses as the key of img. It
+//           doesn't depend on the byte order of the host.
+std::uint64_t Seam_cache_key(const Image* img);
+
+// REQUIRES: cache was initialized by Seam_cache_init
+//           order points to a Seam_order
+//           img points to a valid Image
+//           0 < min_width && min_width <= Image_width(img)
+// MODIFIES: *cache, *order, the file system
+// EFFECTS:  Fills order with a Seam_order of img that goes down to
+//           min_width or further. If the cache holds one, it is read and
+//           marked as recently used (a hit). Otherwise it is computed with
+//           Seam_order_init and stored, evicting old records as needed (a
+//           miss). Errors reading or writing the cache are treated as
+//           misses; the Seam_order is always filled.
+void Seam_cache_get(Seam_cache* cache, Seam_order* order, const Image* img,
+                    int min_width);
+
+// REQUIRES: cache points to a valid Seam_cache
+// MODIFIES: os
+// EFFECTS:  Prints the hit, miss and eviction counts of the cache.
+void Seam_cache_print_stats(const Seam_cache* cache, std::ostream& os);
+
 
 #endif // PROCESSING_H
@@ -1,4 +1,7 @@
 #include "processing_test_helpers.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
 
 
 // REQUIRES: mat points to a valid Matrix
@@ -10,4 +13,30 @@ bool border_element(const Matrix* mat, int r, int c){
     return true;
   }
   return false;
-} 
\ No newline at end of file
+} 
+
+// Number of calls to operator new so far.
+static std::atomic<long> allocations(0);
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr){
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+// EFFECTS: Returns the number of heap allocations (calls to operator new)
+//          the program has made so far.
+long heap_allocation_count(){
+  return allocations.load(std::memory_order_relaxed);
+}
\ No newline at end of file
@@ -11,4 +11,9 @@
 // EFFECTS: Returns true if the element is on the Matrix border.  Returns false otherwise. 
 bool border_element(const Matrix* mat, int r, int c);
 
+// EFFECTS: Returns the number of heap allocations (calls to operator new)
+//          the program has made so far. processing_test_helpers.cpp
+//          replaces the global allocation functions to count them.
+long heap_allocation_count();
+
 #endif // PROCESSING_TEST_HELPERS_H
\ No newline at end of file
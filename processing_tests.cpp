@@ -1,6 +1,7 @@
 #include "Matrix.h"
 #include "Image.h"
 #include "processing.h"
+#include "instrumentation.h"
 #include "unit_test_framework.h"
 #include "Matrix_test_helpers.h"
 #include "Image_test_helpers.h"
@@ -9,6 +10,10 @@
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
 
 using namespace std;
 
@@ -314,4 +319,842 @@ TEST(test_seam_carve_same_width_and_height){
   delete img; // delete the image    
 }
 
+// Removes seams one at a time from a 9x7 Image and checks that the
+// incrementally updated energy matrix always matches a full recompute,
+// including seams that touch the first and last columns.
+TEST(test_energy_tracker_matches_full_recompute){
+  Image *img = new Image; // create an Image in dynamic memory
+  Energy_tracker *tracker = new Energy_tracker;
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *cost = new Matrix;
+
+  Image_init(img, 9, 7);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 37 + c * 91) % 256, (r * c * 13) % 256, (c * 59) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Energy_tracker_init(tracker, img);
+
+  int seam[7];
+  const int first_column_seam[] = {0, 0, 1, 0, 0, 1, 0};
+  const int last_column_seam[] = {7, 7, 6, 7, 7, 7, 6};
+  for (int i = 0; Image_width(img) > 2; ++i){
+    if (i == 0){
+      std::copy(first_column_seam, first_column_seam + 7, seam);
+    }else if (i == 1){
+      std::copy(last_column_seam, last_column_seam + 7, seam);
+    }else{
+      compute_vertical_cost_matrix(&tracker->energy, cost);
+      find_minimal_vertical_seam(cost, seam);
+    }
+    remove_vertical_seam(img, seam);
+    Energy_tracker_remove_seam(tracker, img, seam);
+
+    compute_energy_matrix(img, energy);
+    ASSERT_TRUE(Matrix_equal(&tracker->energy, energy));
+  }
+
+  delete img; // delete the Image
+  delete tracker;
+  delete energy; // delete the Matrix
+  delete cost;
+}
+
+// Carves a 12x8 Image down to 2 columns and checks that the incrementally
+// updated cost matrix always matches a full recompute from the energy.
+TEST(test_update_vertical_cost_matrix_matches_full_recompute){
+  Image *img = new Image; // create an Image in dynamic memory
+  Energy_tracker *tracker = new Energy_tracker;
+  Matrix *cost = new Matrix; // create a Matrix in dynamic memory
+  Matrix *full_cost = new Matrix;
+
+  Image_init(img, 12, 8);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 71 + c * 29) % 256, (r * r * c) % 256, (r * 11 + c * c * 7) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Energy_tracker_init(tracker, img);
+  compute_vertical_cost_matrix(&tracker->energy, cost);
+
+  int seam[8];
+  while (Image_width(img) > 2){
+    find_minimal_vertical_seam(cost, seam);
+    remove_vertical_seam(img, seam);
+    Energy_tracker_remove_seam(tracker, img, seam);
+    update_vertical_cost_matrix(&tracker->energy, cost, seam);
+
+    compute_vertical_cost_matrix(&tracker->energy, full_cost);
+    ASSERT_TRUE(Matrix_equal(cost, full_cost));
+  }
+
+  delete img; // delete the Image
+  delete tracker;
+  delete cost; // delete the Matrix
+  delete full_cost;
+}
+
+// Removes the same seam from two copies of a 5x7 Image, one serially and
+// one split across 3 threads of the pool, and checks both give the same
+// Image.
+TEST(test_remove_vertical_seam_threaded){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image_init(img, 5, 7);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {r, c, r * c};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Image *threaded_img = new Image(*img);
+
+  const int seam[] = {4, 3, 2, 1, 0, 0, 1};
+  remove_vertical_seam(img, seam);
+  set_num_threads(3);
+  remove_vertical_seam(threaded_img, seam);
+  set_num_threads(1);
+
+  ASSERT_EQUAL(Image_width(threaded_img), 4);
+  ASSERT_TRUE(Image_equal(img, threaded_img));
+  Pixel expected = {6, 2, 12}; // row 6 loses column 1
+  ASSERT_TRUE(Pixel_equal(Image_get_pixel(threaded_img, 6, 1), expected));
+
+  delete img; // delete the image
+  delete threaded_img;
+}
+
+// Checks that native horizontal seam carving gives exactly the Image the
+// rotate, carve width, rotate back approach gives, on an Image with many
+// equal energies so that tie-breaking matters.
+TEST(test_seam_carve_height_matches_rotation){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image_init(img, 7, 9);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 3 + c) % 4 * 40, (r * c) % 3 * 60, (c % 2) * 90};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Image *rotated_img = new Image(*img);
+
+  seam_carve_height(img, 3);
+  rotate_left(rotated_img);
+  seam_carve_width(rotated_img, 3);
+  rotate_right(rotated_img);
+
+  ASSERT_EQUAL(Image_height(img), 3);
+  ASSERT_TRUE(Image_equal(img, rotated_img));
+
+  delete img; // delete the image
+  delete rotated_img;
+}
+
+TEST(test_compute_energy_matrix_simd_levels){
+  Image *img = new Image; // create an Image in dynamic memory
+  Matrix *expected = new Matrix; // create a Matrix in dynamic memory
+  Matrix *energy = new Matrix;
+
+  // widths that leave a scalar tail after the 4 and 8 column kernels
+  const int widths[] = {1, 2, 3, 6, 13, 21};
+  const Simd_level original = get_simd_level();
+  for (int width : widths){
+    Image_init(img, width, 5);
+    for (int r = 0; r < Image_height(img); ++r){
+      for (int c = 0; c < Image_width(img); ++c){
+        Pixel color = {(r * 101 + c * 67) % 256, (r * c * 29) % 256, 255 - (c * 43) % 256};
+        Image_set_pixel(img, r, c, color);
+      }
+    }
+    set_simd_level(SIMD_SCALAR);
+    compute_energy_matrix(img, expected);
+    for (int level = SIMD_SSE2; level <= simd_level_supported(); ++level){
+      set_simd_level(static_cast<Simd_level>(level));
+      compute_energy_matrix(img, energy);
+      ASSERT_TRUE(Matrix_equal(energy, expected));
+    }
+  }
+  set_simd_level(original);
+
+  delete img; // delete the Image
+  delete expected; // delete the Matrix
+  delete energy;
+}
+
+TEST(test_compute_vertical_cost_matrix_simd_levels){
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *expected = new Matrix;
+  Matrix *cost = new Matrix;
+
+  // widths that leave a scalar tail after the 4 and 8 column kernels
+  const int widths[] = {1, 2, 3, 6, 13, 21};
+  const Simd_level original = get_simd_level();
+  for (int width : widths){
+    Matrix_init(energy, width, 6);
+    for (int r = 0; r < Matrix_height(energy); ++r){
+      for (int c = 0; c < Matrix_width(energy); ++c){
+        *Matrix_at(energy, r, c) = (r * 7919 + c * c * 104729) % 3901;
+      }
+    }
+    set_simd_level(SIMD_SCALAR);
+    compute_vertical_cost_matrix(energy, expected);
+    for (int level = SIMD_SSE2; level <= simd_level_supported(); ++level){
+      set_simd_level(static_cast<Simd_level>(level));
+      compute_vertical_cost_matrix(energy, cost);
+      ASSERT_TRUE(Matrix_equal(cost, expected));
+    }
+  }
+  set_simd_level(original);
+
+  delete energy; // delete the Matrix
+  delete expected;
+  delete cost;
+}
+
+TEST(test_thread_pool_matches_serial){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *expected_img = new Image;
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *expected = new Matrix;
+
+  Image_init(img, 23, 17);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 71 + c * 13) % 256, (r * r * c * 7) % 256, (c * 151 + r) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  *expected_img = *img;
+  compute_energy_matrix(img, expected);
+  seam_carve(expected_img, 11, 9);
+
+  // includes more threads than rows
+  const int thread_counts[] = {2, 3, 40};
+  for (int num_threads : thread_counts){
+    set_num_threads(num_threads);
+    ASSERT_EQUAL(get_num_threads(), num_threads);
+    compute_energy_matrix(img, energy);
+    ASSERT_TRUE(Matrix_equal(energy, expected));
+
+    Image *carved = new Image(*img);
+    seam_carve(carved, 11, 9);
+    ASSERT_TRUE(Image_equal(carved, expected_img));
+    delete carved;
+  }
+  set_num_threads(1);
+
+  delete img; // delete the Image
+  delete expected_img;
+  delete energy; // delete the Matrix
+  delete expected;
+}
+
+TEST(test_compute_vertical_cost_matrix_tiled){
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *expected = new Matrix;
+  Matrix *cost = new Matrix;
+
+  // Many equal energies make sure ties come out the same, and the
+  // heights cover partial and multiple blocks of tiles.
+  const int heights[] = {1, 2, 40, 150};
+  for (int height : heights){
+    Matrix_init(energy, 301, height);
+    for (int r = 0; r < Matrix_height(energy); ++r){
+      for (int c = 0; c < Matrix_width(energy); ++c){
+        *Matrix_at(energy, r, c) = (r * 31 + c * c * 17) % 5;
+      }
+    }
+    compute_vertical_cost_matrix(energy, expected);
+    for (int num_threads = 2; num_threads <= 5; ++num_threads){
+      set_num_threads(num_threads);
+      compute_vertical_cost_matrix(energy, cost);
+      ASSERT_TRUE(Matrix_equal(cost, expected));
+    }
+    set_num_threads(1);
+  }
+
+  delete energy; // delete the Matrix
+  delete expected;
+  delete cost;
+}
+
+TEST(test_find_minimal_vertical_seam_backpointers){
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *cost = new Matrix;
+  Seam_backpointers *backpointers = new Seam_backpointers;
+
+  // Few distinct energies make ties common, so the leftmost rule matters.
+  const int widths[] = {1, 2, 3, 17};
+  for (int width : widths){
+    Matrix_init(energy, width, 9);
+    for (int r = 0; r < Matrix_height(energy); ++r){
+      for (int c = 0; c < Matrix_width(energy); ++c){
+        *Matrix_at(energy, r, c) = (r * 5 + c * c * 3) % 4;
+      }
+    }
+    int expected[9];
+    int seam[9];
+    compute_vertical_cost_matrix(energy, cost);
+    find_minimal_vertical_seam(cost, expected);
+    compute_vertical_seam_backpointers(energy, backpointers);
+    find_minimal_vertical_seam(backpointers, seam);
+    ASSERT_SEQUENCE_EQUAL(seam, expected);
+  }
+
+  delete energy; // delete the Matrix
+  delete cost;
+  delete backpointers;
+}
+
+TEST(test_seam_carve_width_backpointers){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *expected = new Image;
+
+  Image_init(img, 19, 11);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 17 + c * 5) % 256, (r * c * 3) % 256, (c * 47) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  *expected = *img;
+  seam_carve_width(expected, 4);
+
+  set_seam_dp_mode(SEAM_DP_BACKPOINTERS);
+  seam_carve_width(img, 4);
+  set_seam_dp_mode(SEAM_DP_COST_MATRIX);
+  ASSERT_TRUE(Image_equal(img, expected));
+
+  delete img; // delete the Image
+  delete expected;
+}
+
+TEST(test_find_disjoint_vertical_seams){
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *cost = new Matrix;
+
+  Matrix_init(energy, 12, 10);
+  for (int r = 0; r < Matrix_height(energy); ++r){
+    for (int c = 0; c < Matrix_width(energy); ++c){
+      *Matrix_at(energy, r, c) = (r * 7 + c * c * 3) % 10;
+    }
+  }
+  compute_vertical_cost_matrix(energy, cost);
+  int expected[10];
+  find_minimal_vertical_seam(cost, expected);
+
+  int seams[6 * 10];
+  const int found = find_disjoint_vertical_seams(cost, 6, INFINITY, seams);
+  ASSERT_TRUE(found >= 1 && found <= 6);
+  ASSERT_TRUE(std::equal(expected, expected + 10, seams));
+
+  // Every seam is connected, and no two share or cross over a pixel.
+  for (int i = 0; i < found; ++i){
+    const int *seam = seams + i * 10;
+    for (int r = 1; r < 10; ++r){
+      ASSERT_TRUE(std::abs(seam[r] - seam[r - 1]) <= 1);
+    }
+    for (int j = 0; j < i; ++j){
+      const int *other = seams + j * 10;
+      for (int r = 0; r < 10; ++r){
+        ASSERT_NOT_EQUAL(seam[r], other[r]);
+        ASSERT_EQUAL(seam[r] < other[r], seam[0] < other[0]);
+      }
+    }
+  }
+
+  // A cost ratio of 1 only allows seams as cheap as the first.
+  const int cheapest = *Matrix_at(cost, 9, expected[9]);
+  const int cheap_found = find_disjoint_vertical_seams(cost, 6, 1.0, seams);
+  for (int i = 0; i < cheap_found; ++i){
+    ASSERT_EQUAL(*Matrix_at(cost, 9, seams[i * 10 + 9]), cheapest);
+  }
+
+  delete energy; // delete the Matrix
+  delete cost;
+}
+
+TEST(test_seam_carve_width_batched){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *expected = new Image;
+
+  Image_init(img, 30, 8);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 17 + c * 5) % 256, (r * c * 3) % 256, (c * 47) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  *expected = *img;
+  seam_carve_width(expected, 9);
+
+  // One seam per pass is exact.
+  Image *single = new Image(*img);
+  seam_carve_width_batched(single, 9, 1, INFINITY);
+  ASSERT_TRUE(Image_equal(single, expected));
+
+  seam_carve_width_batched(img, 9, 8, INFINITY);
+  ASSERT_EQUAL(Image_width(img), 9);
+  ASSERT_EQUAL(Image_height(img), 8);
+
+  delete img; // delete the Image
+  delete expected;
+  delete single;
+}
+
+TEST(test_seam_order_carve_matches_seam_carve_width){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *expected = new Image;
+  Image *carved = new Image;
+  Seam_order *order = new Seam_order;
+
+  Image_init(img, 15, 7);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 43 + c * 19) % 256, (r * c * 11) % 256, (c * 83 + r * 5) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Seam_order_init(order, img, 3);
+  for (int width = 3; width <= Image_width(img); ++width){
+    *expected = *img;
+    seam_carve_width(expected, width);
+    Seam_order_carve(order, img, width, carved);
+    ASSERT_TRUE(Image_equal(carved, expected));
+  }
+
+  delete img; // delete the Image
+  delete expected;
+  delete carved;
+  delete order;
+}
+
+TEST(test_seam_order_print_read_round_trip){
+  Image *img = new Image; // create an Image in dynamic memory
+  Seam_order *order = new Seam_order;
+  Seam_order *read = new Seam_order;
+
+  Image_init(img, 6, 4);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 90 + c * 31) % 256, (c * 77) % 256, (r * 13) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  Seam_order_init(order, img, 2);
+  std::ostringstream out;
+  Seam_order_write(order, out);
+  std::istringstream in(out.str());
+  ASSERT_TRUE(Seam_order_read(read, in, out.str().size()));
+  ASSERT_EQUAL(read->min_width, 2);
+  ASSERT_EQUAL(read->image_key, Seam_cache_key(img));
+  ASSERT_TRUE(Matrix_equal(&read->removed_at, &order->removed_at));
+
+  // A 3x1 order down to width 1, whose elements are the last 6 bytes.
+  const std::string header("SEAMORD\x02\x01\0\0\0\x03\0\0\0\x01\0\0\0"
+                           "\x07\0\0\0\0\0\0\0\x02", 29);
+  std::istringstream good(header + std::string("\0\0\x02\0\x01\0", 6));
+  ASSERT_TRUE(Seam_order_read(read, good, 35));
+  ASSERT_EQUAL(*Matrix_at(&read->removed_at, 0, 2), 1);
+  ASSERT_EQUAL(read->image_key, 7u);
+  // Two pixels of a row removed at the same iteration is inconsistent.
+  std::istringstream bad(header + std::string("\0\0\0\0\x01\0", 6));
+  ASSERT_FALSE(Seam_order_read(read, bad, 35));
+  std::istringstream truncated(header + std::string("\0\0\x01\0", 4));
+  ASSERT_FALSE(Seam_order_read(read, truncated, 35));
+  // A header claiming a huge order is rejected against the record's size
+  // before anything is allocated.
+  const std::string huge("SEAMORD\x02\x01\0\0\0\x04\xb5\0\0\x04\xb5\0\0"
+                         "\x07\0\0\0\0\0\0\0\x04", 29);
+  std::istringstream lying(huge + std::string("\0\0\x02\0\x01\0", 6));
+  ASSERT_FALSE(Seam_order_read(read, lying, 35));
+  std::istringstream text("SEAM_ORDER 1\n3 1\n0 1 2 \n");
+  ASSERT_FALSE(Seam_order_read(read, text, 24));
+
+  delete img; // delete the Image
+  delete order;
+  delete read;
+}
+
+TEST(test_seam_cache_hits_misses_and_evictions){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *other = new Image;
+  Seam_order *order = new Seam_order;
+  Seam_order *expected = new Seam_order;
+  Seam_cache *cache = new Seam_cache;
+
+  Image_init(img, 9, 5);
+  Image_init(other, 9, 5);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 43 + c * 19) % 256, (r * c * 11) % 256, (c * 83) % 256};
+      Image_set_pixel(img, r, c, color);
+      Pixel other_color = {color.b, color.r, color.g};
+      Image_set_pixel(other, r, c, other_color);
+    }
+  }
+  ASSERT_NOT_EQUAL(Seam_cache_key(img), Seam_cache_key(other));
+  Seam_order_init(expected, img, 3);
+
+  const std::filesystem::path directory =
+    std::filesystem::temp_directory_path() / "processing_tests_seam_cache";
+  std::filesystem::remove_all(directory);
+  Seam_cache_init(cache, directory.string(), 1 << 20);
+
+  Seam_cache_get(cache, order, img, 3);
+  ASSERT_TRUE(Matrix_equal(&order->removed_at, &expected->removed_at));
+  Seam_cache_get(cache, order, img, 4);
+  ASSERT_TRUE(Matrix_equal(&order->removed_at, &expected->removed_at));
+  ASSERT_EQUAL(cache->misses, 1);
+  ASSERT_EQUAL(cache->hits, 1);
+
+  // A narrower width than the cached order reaches is a miss.
+  Seam_cache_get(cache, order, img, 2);
+  ASSERT_EQUAL(order->min_width, 2);
+  ASSERT_EQUAL(cache->misses, 2);
+
+  // With room for only one record, storing another evicts the first.
+  cache->max_bytes = 1;
+  Seam_cache_get(cache, order, other, 3);
+  ASSERT_EQUAL(cache->evictions, 1);
+  Seam_cache_get(cache, order, img, 3);
+  ASSERT_EQUAL(cache->misses, 4);
+  ASSERT_EQUAL(cache->hits, 1);
+
+  std::filesystem::remove_all(directory);
+  delete img; // delete the Image
+  delete other;
+  delete order;
+  delete expected;
+  delete cache;
+}
+
+// Runs the processing functions on the same pixels in both layouts and
+// checks they agree, and that each result keeps its Image's layout.
+TEST(test_interleaved_layout_matches_planar){
+  Image *planar = new Image; // create an Image in dynamic memory
+  Image *interleaved = new Image;
+  Matrix *planar_energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *interleaved_energy = new Matrix;
+
+  Image_init(planar, 21, 9);
+  for (int r = 0; r < Image_height(planar); ++r){
+    for (int c = 0; c < Image_width(planar); ++c){
+      Pixel color = {(r * 43 + c * 19) % 256, (r * c * 11) % 256, (c * 83 + r * 5) % 256};
+      Image_set_pixel(planar, r, c, color);
+    }
+  }
+  *interleaved = *planar;
+  Image_set_layout(interleaved, IMAGE_INTERLEAVED);
+  ASSERT_EQUAL(Seam_cache_key(planar), Seam_cache_key(interleaved));
+
+  const Simd_level original = get_simd_level();
+  for (int level = SIMD_SCALAR; level <= simd_level_supported(); ++level){
+    set_simd_level(static_cast<Simd_level>(level));
+    compute_energy_matrix(planar, planar_energy);
+    compute_energy_matrix(interleaved, interleaved_energy);
+    ASSERT_TRUE(Matrix_equal(planar_energy, interleaved_energy));
+  }
+  set_simd_level(original);
+
+  rotate_left(interleaved);
+  ASSERT_EQUAL(Image_get_layout(interleaved), IMAGE_INTERLEAVED);
+  rotate_right(interleaved);
+  ASSERT_TRUE(Image_equal(planar, interleaved));
+
+  Seam_order *order = new Seam_order;
+  Image *carved = new Image;
+  Seam_order_init(order, interleaved, 10);
+  Seam_order_carve(order, interleaved, 12, carved);
+  ASSERT_EQUAL(Image_get_layout(carved), IMAGE_INTERLEAVED);
+
+  seam_carve(planar, 12, 6);
+  seam_carve(interleaved, 12, 6);
+  ASSERT_EQUAL(Image_get_layout(interleaved), IMAGE_INTERLEAVED);
+  ASSERT_TRUE(Image_equal(planar, interleaved));
+
+  seam_carve_width_batched(planar, 8, 2, INFINITY);
+  seam_carve_width_batched(interleaved, 8, 2, INFINITY);
+  ASSERT_TRUE(Image_equal(planar, interleaved));
+
+  delete planar; // delete the Image
+  delete interleaved;
+  delete carved;
+  delete order;
+  delete planar_energy; // delete the Matrix
+  delete interleaved_energy;
+}
+
+// Carves with a warmed-up Seam_carver in every configuration and checks
+// that nothing is allocated, and that the results match the functions
+// that use a Seam_carver of their own.
+TEST(test_seam_carver_does_not_allocate_after_warm_up){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *carved = new Image;
+  Image *expected = new Image;
+  Seam_carver *carver = new Seam_carver; // create a Seam_carver in dynamic memory
+  Seam_carver_init(carver);
+
+  Image_init(img, 40, 30);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 43 + c * 19) % 256, (r * c * 11) % 256, (c * 83 + r * 5) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+
+  // Runs every configuration, adding up the allocations made while
+  // carving; returns whether each result matched.
+  long allocations = 0;
+  auto carve_all = [&](bool check) {
+    bool matched = true;
+    for (int threads = 1; threads <= 2; ++threads){
+      set_num_threads(threads);
+      for (Image_layout layout : {IMAGE_PLANAR, IMAGE_INTERLEAVED}){
+        for (Seam_dp_mode mode : {SEAM_DP_COST_MATRIX, SEAM_DP_BACKPOINTERS}){
+          set_seam_dp_mode(mode);
+          *carved = *img;
+          Image_set_layout(carved, layout);
+          const long allocations_before = heap_allocation_count();
+          Seam_carver_carve(carver, carved, 25, 20);
+          allocations += heap_allocation_count() - allocations_before;
+          if (check){
+            *expected = *img;
+            seam_carve(expected, 25, 20);
+            matched = matched && Image_equal(carved, expected);
+          }
+        }
+        set_seam_dp_mode(SEAM_DP_COST_MATRIX);
+        *carved = *img;
+        Image_set_layout(carved, layout);
+        const long allocations_before = heap_allocation_count();
+        Seam_carver_carve_width_batched(carver, carved, 22, 4, INFINITY);
+        allocations += heap_allocation_count() - allocations_before;
+        if (check){
+          *expected = *img;
+          seam_carve_width_batched(expected, 22, 4, INFINITY);
+          matched = matched && Image_equal(carved, expected);
+        }
+      }
+    }
+    set_num_threads(1);
+    return matched;
+  };
+
+  carve_all(false);
+  const int warm_allocations = Seam_carver_allocations(carver);
+  ASSERT_TRUE(warm_allocations > 0);
+  allocations = 0;
+  ASSERT_TRUE(carve_all(true));
+  ASSERT_EQUAL(allocations, 0);
+  ASSERT_EQUAL(Seam_carver_allocations(carver), warm_allocations);
+
+  delete img; // delete the Image
+  delete carved;
+  delete expected;
+  delete carver; // delete the Seam_carver
+}
+
+// Checks the tiled rotations and the flips pixel by pixel, on sizes with
+// whole blocks, partial blocks and both, square and not, in every layout,
+// Simd_level and thread count.
+TEST(test_rotations_and_flips){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image *turned = new Image;
+
+  const int sizes[][2] = {{1, 1}, {5, 3}, {16, 16}, {33, 33}, {37, 21}, {64, 48}, {20, 70}};
+  const Simd_level original = get_simd_level();
+  for (const auto& size : sizes){
+    const int width = size[0];
+    const int height = size[1];
+    Image_init(img, width, height);
+    for (int r = 0; r < height; ++r){
+      for (int c = 0; c < width; ++c){
+        Pixel color = {(r * 7 + c) % 256, (c * 13) % 256, (r * c) % 256};
+        Image_set_pixel(img, r, c, color);
+      }
+    }
+    for (int threads = 1; threads <= 2; ++threads){
+      set_num_threads(threads);
+      for (int level = SIMD_SCALAR; level <= simd_level_supported(); ++level){
+        set_simd_level(static_cast<Simd_level>(level));
+        for (Image_layout layout : {IMAGE_PLANAR, IMAGE_INTERLEAVED}){
+          Image_set_layout(img, layout);
+
+          *turned = *img;
+          rotate_left(turned);
+          ASSERT_EQUAL(Image_width(turned), height);
+          ASSERT_EQUAL(Image_height(turned), width);
+          ASSERT_EQUAL(Image_get_layout(turned), layout);
+          bool matched = true;
+          for (int r = 0; r < height; ++r){
+            for (int c = 0; c < width; ++c){
+              matched = matched && Pixel_equal(Image_get_pixel(turned, width - 1 - c, r),
+                                               Image_get_pixel(img, r, c));
+            }
+          }
+          ASSERT_TRUE(matched);
+
+          *turned = *img;
+          rotate_right(turned);
+          matched = true;
+          for (int r = 0; r < height; ++r){
+            for (int c = 0; c < width; ++c){
+              matched = matched && Pixel_equal(Image_get_pixel(turned, c, height - 1 - r),
+                                               Image_get_pixel(img, r, c));
+            }
+          }
+          ASSERT_TRUE(matched);
+
+          *turned = *img;
+          rotate_180(turned);
+          flip_horizontal(turned);
+          flip_vertical(turned);
+          ASSERT_TRUE(Image_equal(turned, img));
+          flip_horizontal(turned);
+          matched = true;
+          for (int r = 0; r < height; ++r){
+            for (int c = 0; c < width; ++c){
+              matched = matched && Pixel_equal(Image_get_pixel(turned, r, width - 1 - c),
+                                               Image_get_pixel(img, r, c));
+            }
+          }
+          ASSERT_TRUE(matched);
+          flip_horizontal(turned);
+          rotate_left(turned);
+          rotate_left(turned);
+          rotate_180(turned);
+          ASSERT_TRUE(Image_equal(turned, img));
+        }
+      }
+    }
+  }
+  set_simd_level(original);
+  set_num_threads(1);
+
+  delete img; // delete the Image
+  delete turned;
+}
+
+// The fused energy and cost pass must match the two stages run one after
+// the other, including on Images too small to have non-border pixels and
+// on ones wide enough for the tiled cost matrix.
+TEST(test_compute_energy_and_cost_matrices){
+  Image *img = new Image; // create an Image in dynamic memory
+  Matrix *energy = new Matrix; // create a Matrix in dynamic memory
+  Matrix *cost = new Matrix;
+  Matrix *expected_energy = new Matrix;
+  Matrix *expected_cost = new Matrix;
+
+  const int sizes[][2] = {{1, 1}, {1, 6}, {2, 5}, {6, 1}, {3, 3}, {13, 2}, {21, 17}, {150, 9}};
+  const Simd_level original = get_simd_level();
+  for (const auto& size : sizes){
+    Image_init(img, size[0], size[1]);
+    for (int r = 0; r < Image_height(img); ++r){
+      for (int c = 0; c < Image_width(img); ++c){
+        Pixel color = {(r * 59 + c * 31) % 256, (r * c * 7) % 256, (c * c + r) % 256};
+        Image_set_pixel(img, r, c, color);
+      }
+    }
+    compute_energy_matrix(img, expected_energy);
+    compute_vertical_cost_matrix(expected_energy, expected_cost);
+    const int border = *Matrix_at(expected_energy, 0, 0);
+    for (int threads = 1; threads <= 2; ++threads){
+      set_num_threads(threads);
+      for (int level = SIMD_SCALAR; level <= simd_level_supported(); ++level){
+        set_simd_level(static_cast<Simd_level>(level));
+        for (Image_layout layout : {IMAGE_PLANAR, IMAGE_INTERLEAVED}){
+          Image_set_layout(img, layout);
+          // Guesses of the border energy that are too high, too low and
+          // right.
+          for (int guess : {MAX_ENERGY, 0, border}){
+            int border_energy = guess;
+            compute_energy_and_cost_matrices(img, nullptr, cost, &border_energy);
+            ASSERT_TRUE(Matrix_equal(cost, expected_cost));
+            ASSERT_EQUAL(border_energy, border);
+          }
+          int border_energy = MAX_ENERGY;
+          compute_energy_and_cost_matrices(img, energy, cost, &border_energy);
+          ASSERT_TRUE(Matrix_equal(energy, expected_energy));
+          ASSERT_TRUE(Matrix_equal(cost, expected_cost));
+          ASSERT_EQUAL(border_energy, border);
+        }
+      }
+    }
+  }
+  set_simd_level(original);
+  set_num_threads(1);
+
+  delete img; // delete the Image
+  delete energy; // delete the Matrix
+  delete cost;
+  delete expected_energy;
+  delete expected_cost;
+}
+
+// Checks that the instrumentation times the stages of a carve, counts
+// the seams it removes, traces each run and records nothing once stopped.
+TEST(test_instrumentation_records_stages){
+  Image *img = new Image; // create an Image in dynamic memory
+  Image_init(img, 20, 15);
+  for (int r = 0; r < Image_height(img); ++r){
+    for (int c = 0; c < Image_width(img); ++c){
+      Pixel color = {(r * 43 + c * 19) % 256, (r * c * 11) % 256, (c * 83 + r * 5) % 256};
+      Image_set_pixel(img, r, c, color);
+    }
+  }
+  ostringstream ppm;
+  Image_print(img, ppm);
+
+  Instrumentation_start(true);
+  istringstream input(ppm.str());
+  Image_init(img, input);
+  seam_carve(img, 15, 12);
+  Instrumentation_stop();
+  seam_carve(img, 14, 11);
+
+  const Instrumentation* inst = Instrumentation_get();
+  if (INSTRUMENTATION){
+    ASSERT_EQUAL(inst->counters[COUNTER_SEAMS_REMOVED], 8);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_PARSE], 1);
+    ASSERT_EQUAL(inst->stage_pixels[STAGE_PARSE], 300);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_CARVE_WIDTH], 1);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_CARVE_HEIGHT], 1);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_REMOVAL], 8);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_BACKTRACK], 8);
+    ASSERT_TRUE(inst->stage_calls[STAGE_ENERGY] > 0);
+    ASSERT_TRUE(inst->stage_calls[STAGE_DP] > 0);
+    ASSERT_TRUE(inst->counters[COUNTER_ALLOCATIONS] > 0);
+    long long runs = 0;
+    for (int s = 0; s < NUM_STAGES; ++s){
+      runs += inst->stage_calls[s];
+    }
+    ASSERT_EQUAL(inst->events.size(), static_cast<size_t>(runs));
+  }
+
+  // Carving from a Seam_order counts its seams once, although recording
+  // the order carves a copy of the Image too.
+  Seam_order *order = new Seam_order;
+  Image *carved = new Image;
+  Instrumentation_start(false);
+  Seam_order_init(order, img, 10);
+  Seam_order_carve(order, img, 12, carved);
+  Instrumentation_stop();
+  if (INSTRUMENTATION){
+    ASSERT_EQUAL(inst->counters[COUNTER_SEAMS_REMOVED], 2);
+    ASSERT_EQUAL(inst->stage_calls[STAGE_CARVE_WIDTH], 2);
+  }
+  delete carved;
+  delete order;
+
+  ostringstream text;
+  Instrumentation_print_json(text);
+  ASSERT_TRUE(text.str().find("\"seams_removed\": " +
+                              to_string(INSTRUMENTATION ? 2 : 0)) != string::npos);
+
+  delete img; // delete the Image
+}
+
 TEST_MAIN()
\ No newline at end of file
@@ -1,62 +1,341 @@
 #include "Matrix.h"
 #include "Image.h"
 #include "processing.h"
+#include "instrumentation.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <filesystem>
 #include <fstream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
 
+static void print_usage(){
+    cout << "Usage: resize.exe [--format p3|p6] [--threads N] [--batch K] IN_FILENAME OUT_FILENAME WIDTH [HEIGHT]\n"
+    << "       resize.exe [--format p3|p6] [--threads N] --widths W1,W2,... [--seam-order ORDER_FILENAME] IN_FILENAME OUT_FILENAME\n"
+    << "Both forms also take [--layout planar|interleaved]\n"
+    << "  and [--cache DIR [--cache-size BYTES] [--cache-stats]]\n"
+    << "  and [--profile text|json] [--trace TRACE_FILENAME]\n"
+    << "WIDTH and HEIGHT must be less than or equal to original\n"
+    << "--format selects plain (p3, the default) or binary (p6) PPM output\n"
+    << "--threads sets how many threads to use (1 by default)\n"
+    << "--layout selects how pixels are stored while carving: one plane per\n"
+    << "  channel (planar, the default) or RGB together (interleaved)\n"
+    << "--batch K removes up to K seams per pass when reducing the width,\n"
+    << "  which is faster but approximate (1, exact, by default)\n"
+    << "--widths carves once and writes one image per width, named\n"
+    << "  OUT_FILENAME with _WIDTH added before the extension (always\n"
+    << "  exactly, so it can't be combined with --batch)\n"
+    << "--seam-order, which needs --widths, reuses the seam order saved in\n"
+    << "  ORDER_FILENAME if it fits, and otherwise computes it and saves it there\n"
+    << "--cache DIR reuses the seam orders of images carved before, kept in\n"
+    << "  DIR (the width is then always carved exactly, so it can't be\n"
+    << "  combined with --batch). Only the width is cached: the height is\n"
+    << "  always carved from scratch\n"
+    << "--cache-size BYTES bounds the cache, evicting the least recently\n"
+    << "  used orders (256 MiB by default)\n"
+    << "--cache-stats prints the cache hits, misses and evictions\n"
+    << "--profile prints the time spent in each stage (parsing, energy, DP,\n"
+    << "  backtracking, removal, rotation and printing) and the seams,\n"
+    << "  pixels and allocations counted, as a table (text) or JSON\n"
+    << "--trace writes every timed stage to TRACE_FILENAME in the Chrome\n"
+    << "  trace event format, for chrome://tracing or Perfetto" << endl;
+}
+
+// EFFECTS: Parses a comma separated list of positive widths into widths.
+//          Returns false if the list is malformed.
+static bool parse_widths(const string& list, vector<int>& widths){
+    size_t start = 0;
+    while (start <= list.size()){
+        size_t end = list.find(',', start);
+        if (end == string::npos){
+            end = list.size();
+        }
+        int width = atoi(list.substr(start, end - start).c_str());
+        if (width < 1){
+            return false;
+        }
+        widths.push_back(width);
+        start = end + 1;
+    }
+    return true;
+}
+
+// EFFECTS: Returns filename with _WIDTH added before its extension.
+static string filename_for_width(const string& filename, int width){
+    size_t dot = filename.rfind('.');
+    size_t slash = filename.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)){
+        dot = filename.size();
+    }
+    return filename.substr(0, dot) + "_" + to_string(width) + filename.substr(dot);
+}
+
+// EFFECTS: Writes img to the given file. Returns false, after printing an
+//          error, if the file can't be opened.
+static bool write_image(const Image* img, const string& filename, Ppm_format format){
+    ofstream fout;
+    fout.open(filename, ios::binary);
+    if (!fout.is_open()) {
+        cout << "Error opening file: " << filename << endl;
+        return false;
+    }
+    Image_print(img, fout, format);
+    return true;
+}
+
+// EFFECTS: Prints the instrumentation records in the given format ("text"
+//          or "json") if it isn't empty, and writes them as a Chrome trace
+//          to trace_filename if that isn't empty. Returns false, after
+//          printing an error, if the trace file can't be opened.
+static bool write_profile(const string& format, const string& trace_filename){
+    Instrumentation_stop();
+    if (format == "text"){
+        Instrumentation_print_text(cout);
+    }else if (format == "json"){
+        Instrumentation_print_json(cout);
+    }
+    if (!trace_filename.empty()){
+        ofstream fout(trace_filename);
+        if (!fout.is_open()){
+            cout << "Error opening file: " << trace_filename << endl;
+            return false;
+        }
+        Instrumentation_print_trace(fout);
+    }
+    return true;
+}
+
+// EFFECTS: Fills order with the seam order of img down to min_width.
+//          With a cache, it comes from the cache unless img is already
+//          min_width wide, which leaves nothing worth caching. Otherwise it is loaded
+//          from order_filename if that holds one recorded from img that
+//          goes down to min_width, and computed
+//          (and saved there, if given) if not.
+static void load_seam_order(Seam_order* order, const Image* img, int min_width,
+                            const string& order_filename, Seam_cache* cache){
+    if (cache && min_width < Image_width(img)){
+        Seam_cache_get(cache, order, img, min_width);
+        return;
+    }
+    if (!order_filename.empty()){
+        ifstream fin(order_filename, ios::binary);
+        error_code error;
+        const uintmax_t record_size = filesystem::file_size(order_filename, error);
+        if (fin.is_open() && !error && Seam_order_read(order, fin, record_size)
+            && order->image_key == Seam_cache_key(img)
+            && Matrix_width(&order->removed_at) == Image_width(img)
+            && Matrix_height(&order->removed_at) == Image_height(img)
+            && order->min_width <= min_width){
+            return;
+        }
+    }
+    Seam_order_init(order, img, min_width);
+    if (!order_filename.empty()){
+        ofstream fout(order_filename, ios::binary);
+        Seam_order_write(order, fout);
+    }
+}
+
 int main(int argc, char *argv[]){
     Image *img = new Image; // create an Image in dynaimc memory
 
-    if (!(argc == 4 || argc == 5)){
-        cout << "Usage: resize.exe IN_FILENAME OUT_FILENAME WIDTH [HEIGHT]\n"
-        << "WIDTH and HEIGHT must be less than or equal to original" << endl;
+    // Separates options from the positional arguments.
+    vector<string> args;
+    Ppm_format output_format = PPM_PLAIN;
+    Image_layout layout = IMAGE_PLANAR;
+    int seams_per_pass = 1;
+    vector<int> widths;
+    string order_filename;
+    string cache_directory;
+    uintmax_t cache_size = uintmax_t(256) << 20;
+    bool print_cache_stats = false;
+    string profile_format;
+    string trace_filename;
+    for (int i = 1; i < argc; ++i){
+        string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc){
+            string format = argv[++i];
+            if (format == "p3"){
+                output_format = PPM_PLAIN;
+            }else if (format == "p6"){
+                output_format = PPM_BINARY;
+            }else{
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--layout" && i + 1 < argc){
+            string name = argv[++i];
+            if (name == "planar"){
+                layout = IMAGE_PLANAR;
+            }else if (name == "interleaved"){
+                layout = IMAGE_INTERLEAVED;
+            }else{
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--threads" && i + 1 < argc){
+            int num_threads = atoi(argv[++i]);
+            if (num_threads < 1){
+                print_usage();
+                return 1;
+            }
+            set_num_threads(num_threads);
+        }else if (arg == "--batch" && i + 1 < argc){
+            seams_per_pass = atoi(argv[++i]);
+            if (seams_per_pass < 1){
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--widths" && i + 1 < argc){
+            if (!parse_widths(argv[++i], widths)){
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--seam-order" && i + 1 < argc){
+            order_filename = argv[++i];
+        }else if (arg == "--cache" && i + 1 < argc){
+            cache_directory = argv[++i];
+        }else if (arg == "--cache-size" && i + 1 < argc){
+            cache_size = strtoull(argv[++i], nullptr, 10);
+        }else if (arg == "--cache-stats"){
+            print_cache_stats = true;
+        }else if (arg == "--profile" && i + 1 < argc){
+            profile_format = argv[++i];
+            if (profile_format != "text" && profile_format != "json"){
+                print_usage();
+                return 1;
+            }
+        }else if (arg == "--trace" && i + 1 < argc){
+            trace_filename = argv[++i];
+        }else{
+            args.push_back(arg);
+        }
+    }
+
+    // Seam orders record exact carves, so a cache or --widths can't serve
+    // batches, and only --widths uses a seam order file.
+    if ((!cache_directory.empty() || !widths.empty()) && seams_per_pass > 1){
+        print_usage();
+        return 1;
+    }
+    if (!order_filename.empty() && widths.empty()){
+        print_usage();
         return 1;
     }
-    string input_filename = argv[1];
-    ifstream fin;
-    fin.open(input_filename);
-    if (!fin.is_open()) {
-        cout << "Error opening file: " << input_filename << endl;
+    if (widths.empty() ? !(args.size() == 3 || args.size() == 4) : args.size() != 2){
+        print_usage();
         return 1;
     }
-    Image_init(img, fin);
-    fin.close();
+    const bool profiling = !profile_format.empty() || !trace_filename.empty();
+    if (profiling && !INSTRUMENTATION){
+        cout << "resize.exe was built with INSTRUMENTATION=0" << endl;
+        return 1;
+    }
+    if (profiling){
+        Instrumentation_start(!trace_filename.empty());
+    }
+
+    string input_filename = args[0];
+    try {
+        if (!Image_init_from_file(img, input_filename, layout)) {
+            cout << "Error opening file: " << input_filename << endl;
+            return 1;
+        }
+    }
+    catch (Ppm_error& error) {
+        cout << "Error reading file: " << input_filename << ": "
+        << error.what() << endl;
+        return 1;
+    }
+
+    Seam_cache *cache = nullptr;
+    if (!cache_directory.empty()){
+        cache = new Seam_cache;
+        Seam_cache_init(cache, cache_directory, cache_size);
+    }
+
+    if (!widths.empty()){
+        // Carves once down to the smallest width, then gathers each width
+        // from the recorded seam order.
+        int min_width = widths[0];
+        for (int width : widths){
+            if (width > Image_width(img)){
+                print_usage();
+                return 1;
+            }
+            min_width = min(min_width, width);
+        }
+        Seam_order *order = new Seam_order;
+        load_seam_order(order, img, min_width, order_filename, cache);
+        Image *carved = new Image;
+        for (int width : widths){
+            Seam_order_carve(order, img, width, carved);
+            if (!write_image(carved, filename_for_width(args[1], width), output_format)){
+                return 1;
+            }
+        }
+        if (cache && print_cache_stats){
+            Seam_cache_print_stats(cache, cout);
+        }
+        if (profiling && !write_profile(profile_format, trace_filename)){
+            return 1;
+        }
+        delete carved;
+        delete order;
+        delete cache;
+        delete img; // delete the image
+        return 0;
+    }
 
-    string new_width_str = argv[3];
+    string new_width_str = args[2];
     int new_width = stoi(new_width_str);
     if (new_width > Image_width(img)){
-        cout << "Usage: resize.exe IN_FILENAME OUT_FILENAME WIDTH [HEIGHT]\n"
-        << "WIDTH and HEIGHT must be less than or equal to original" << endl;
+        print_usage();
         return 1;    
     }
-    
-    if (argc == 4){
-        seam_carve_width(img, new_width); 
-    }else if (argc == 5){
-        string new_height_str = argv[4];
-        int new_height = stoi(new_height_str);
+    int new_height = Image_height(img);
+    if (args.size() == 4){
+        string new_height_str = args[3];
+        new_height = stoi(new_height_str);
         if (new_height > Image_height(img)){
-        cout << "Usage: resize.exe IN_FILENAME OUT_FILENAME WIDTH [HEIGHT]\n"
-        << "WIDTH and HEIGHT must be less than or equal to original" << endl;
+        print_usage();
         return 1;    
         }
-        seam_carve(img, new_width, new_height);
     }
+
+    // Only the width goes through the cache, and only when it changes: a
+    // cache hit replays the recorded seams in one gather pass. The height
+    // is always carved from scratch.
+    if (cache && new_width < Image_width(img)){
+        Seam_order *order = new Seam_order;
+        load_seam_order(order, img, new_width, order_filename, cache);
+        Image *carved = new Image;
+        Seam_order_carve(order, img, new_width, carved);
+        *img = *carved;
+        delete carved;
+        delete order;
+    }else{
+        seam_carve_width_batched(img, new_width, seams_per_pass, INFINITY);
+    }
+    seam_carve_height(img, new_height);
     
-    string output_filename = argv[2];
-    ofstream fout;
-    fout.open(output_filename);
-    if (!fout.is_open()) {
-        cout << "Error opening file: " << output_filename << endl;
+    string output_filename = args[1];
+    if (!write_image(img, output_filename, output_format)){
+        return 1;
+    }
+    if (cache && print_cache_stats){
+        Seam_cache_print_stats(cache, cout);
+    }
+    if (profiling && !write_profile(profile_format, trace_filename)){
         return 1;
     }
-    Image_print(img, fout);
-    fout.close();
     
+    delete cache;
     delete img; // delete the image
     
     return 0;
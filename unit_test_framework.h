@@ -16,6 +16,8 @@
 #include <algorithm>
 #include <exception>
 #include <stdexcept>
+#include <chrono>
+#include <iomanip>
 
 // For compatibility with Visual Studio
 #include <ciso646>
@@ -26,12 +28,24 @@
 
 using Test_func_t = void (*)();
 
+class BenchmarkState;
+using Benchmark_func_t = void (*)(BenchmarkState&);
+
 
 #define TEST(name)                                                            \
     static void name();                                                       \
     static TestRegisterer register_##name((#name), name);                     \
     static void name()
 
+// Registers a micro-benchmark. The body does its setup, then runs the
+// code being timed inside a while (state.keep_running()) loop; only that
+// loop is timed. Pass results to do_not_optimize() so the compiler cannot
+// drop the work. Benchmarks only run when the test program is given -b.
+#define BENCHMARK(name)                                                       \
+    static void name(BenchmarkState& state);                                  \
+    static BenchmarkRegisterer register_##name((#name), name);                \
+    static void name(BenchmarkState& state)
+
 #define TEST_MAIN()                                                           \
     int main(int argc, char** argv) {                                         \
         return TestSuite::get().run_tests(argc, argv);                        \
@@ -39,6 +53,71 @@ using Test_func_t = void (*)();
     TEST_SUITE_INSTANCE();
 
 
+// Keeps the compiler from optimizing away the computation of value.
+template <class T>
+void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "m"(value) : "memory");
+#else
+    static const volatile void* sink;
+    sink = &value;
+#endif
+}
+
+// The loop counter a benchmark body runs its timed loop on.
+class BenchmarkState {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit BenchmarkState(long iterations_)
+        : iterations(iterations_), remaining(iterations_) {}
+
+    // Starts the clock on the first call and stops it once iterations
+    // calls have returned true.
+    bool keep_running() {
+        if (remaining > 0) {
+            if (remaining-- == iterations) {
+                start = Clock::now();
+            }
+            return true;
+        }
+        if (not finished) {
+            stop = Clock::now();
+            finished = true;
+        }
+        return false;
+    }
+
+    // Returns the time the loop took, in nanoseconds.
+    double elapsed_ns() const {
+        if (not finished) {
+            throw std::runtime_error(
+                "benchmark did not run its keep_running() loop to the end");
+        }
+        return std::chrono::duration<double, std::nano>(stop - start).count();
+    }
+
+    const long iterations;
+
+private:
+    long remaining;
+    bool finished = false;
+    Clock::time_point start{};
+    Clock::time_point stop{};
+};
+
+struct BenchmarkCase {
+    BenchmarkCase(const std::string& name_, Benchmark_func_t benchmark_func_)
+        : name(name_), benchmark_func(benchmark_func_) {}
+
+    // Calibrates the number of iterations, warms up, times the samples
+    // and prints their statistics. Returns false if the benchmark failed.
+    bool run();
+
+    std::string name;
+    Benchmark_func_t benchmark_func;
+};
+
 struct TestCase {
     TestCase(const std::string& name_, Test_func_t test_func_)
         : name(name_), test_func(test_func_) {}
@@ -66,7 +145,14 @@ public:
         tests_.insert({test_name, TestCase{test_name, test}});
     }
 
+    void add_benchmark(const std::string& benchmark_name,
+                       Benchmark_func_t benchmark) {
+        benchmarks_.insert(
+            {benchmark_name, BenchmarkCase{benchmark_name, benchmark}});
+    }
+
     int run_tests(int argc, char** argv);
+    int run_benchmarks(const std::vector<std::string>& benchmark_names);
     void print_results();
 
     void enable_quiet_mode() {
@@ -80,6 +166,13 @@ public:
         return os;
     }
 
+    std::ostream& print_benchmark_names(std::ostream& os) {
+        for (const auto& benchmark_pair : benchmarks_) {
+            os << benchmark_pair.first << '\n';
+        }
+        return os;
+    }
+
     friend class TestSuiteDestroyer;
 
 private:
@@ -103,8 +196,10 @@ private:
 
     static TestSuite* instance;
     std::map<std::string, TestCase> tests_;
+    std::map<std::string, BenchmarkCase> benchmarks_;
 
     bool quiet_mode = false;
+    bool benchmark_mode = false;
     static bool incomplete;
 };
 
@@ -122,6 +217,14 @@ public:
     }
 };
 
+class BenchmarkRegisterer {
+public:
+    BenchmarkRegisterer(const std::string& benchmark_name,
+                        Benchmark_func_t benchmark) {
+        TestSuite::get().add_benchmark(benchmark_name, benchmark);
+    }
+};
+
 class TestFailure {
 public:
     TestFailure(std::string reason, int line_number, const char* assertion_text)
@@ -499,6 +602,10 @@ int TestSuite::run_tests(int argc, char** argv) {
         return e.status;
     }
 
+    if (benchmark_mode) {
+        return run_benchmarks(test_names_to_run);
+    }
+
     for (auto test_name : test_names_to_run) {
         if (tests_.find(test_name) == end(tests_)) {
             throw std::runtime_error("Test " + test_name + " not found");
@@ -539,11 +646,127 @@ int TestSuite::run_tests(int argc, char** argv) {
     return 1;
 }
 
+// Each sample runs the benchmark for at least this long.
+const double BENCHMARK_MIN_SAMPLE_NS = 10e6;
+const int BENCHMARK_SAMPLES = 10;
+const long BENCHMARK_MAX_ITERATIONS = 1000000000;
+
+bool BenchmarkCase::run() {
+    try {
+        // Calibrate: grow the iteration count until one sample takes at
+        // least BENCHMARK_MIN_SAMPLE_NS. These runs also warm the caches.
+        long iterations = 1;
+        while (true) {
+            BenchmarkState state(iterations);
+            benchmark_func(state);
+            const double elapsed = state.elapsed_ns();
+            if (elapsed >= BENCHMARK_MIN_SAMPLE_NS or
+                iterations >= BENCHMARK_MAX_ITERATIONS) {
+                break;
+            }
+            const double scale =
+                elapsed > 0 ? 1.2 * BENCHMARK_MIN_SAMPLE_NS / elapsed : 10;
+            iterations = std::min(
+                BENCHMARK_MAX_ITERATIONS,
+                std::max(iterations + 1,
+                         static_cast<long>(iterations * std::min(scale, 10.0))));
+        }
+
+        // Warm up once at the calibrated count, then time the samples.
+        BenchmarkState warm_up(iterations);
+        benchmark_func(warm_up);
+        warm_up.elapsed_ns();
+
+        std::vector<double> samples;
+        for (int i = 0; i < BENCHMARK_SAMPLES; ++i) {
+            BenchmarkState state(iterations);
+            benchmark_func(state);
+            samples.push_back(state.elapsed_ns() / iterations);
+        }
+        std::sort(samples.begin(), samples.end());
+
+        double mean = 0;
+        for (double sample : samples) {
+            mean += sample;
+        }
+        mean /= samples.size();
+        double variance = 0;
+        for (double sample : samples) {
+            variance += (sample - mean) * (sample - mean);
+        }
+        const double stddev = std::sqrt(variance / (samples.size() - 1));
+        const std::size_t middle = samples.size() / 2;
+        const double median = samples.size() % 2
+                                  ? samples[middle]
+                                  : (samples[middle - 1] + samples[middle]) / 2;
+
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << std::left
+            << std::setw(48) << name << std::right
+            << std::setw(12) << samples.front()
+            << std::setw(12) << median
+            << std::setw(12) << mean
+            << std::setw(12) << stddev
+            << std::setw(14) << iterations;
+        std::cout << oss.str() << std::endl;
+        return true;
+    }
+    catch (TestFailure& failure) {
+        std::cout << name << ": FAIL\n" << failure << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cout << name << ": ERROR\nUncaught "
+                  << demangle(typeid(e).name()) << ": " << e.what()
+                  << std::endl;
+    }
+    return false;
+}
+
+int TestSuite::run_benchmarks(
+    const std::vector<std::string>& benchmark_names) {
+    for (auto benchmark_name : benchmark_names) {
+        if (benchmarks_.find(benchmark_name) == end(benchmarks_)) {
+            throw std::runtime_error("Benchmark " + benchmark_name +
+                                     " not found");
+        }
+    }
+
+    std::cout << std::left << std::setw(48) << "benchmark (ns per iteration)"
+              << std::right << std::setw(12) << "min" << std::setw(12)
+              << "median" << std::setw(12) << "mean" << std::setw(12)
+              << "stddev" << std::setw(14) << "iterations" << std::endl;
+    int num_failures = 0;
+    for (auto benchmark_name : benchmark_names) {
+        if (not benchmarks_.at(benchmark_name).run()) {
+            ++num_failures;
+        }
+    }
+    return num_failures == 0 ? 0 : 1;
+}
+
 std::vector<std::string> TestSuite::get_test_names_to_run(int argc,
                                                           char** argv) {
     std::vector<std::string> test_names_to_run;
     for (auto i = 1; i < argc; ++i) {
-        if (argv[i] == std::string("--show_test_names") or
+        if (argv[i] == std::string("--benchmark") or
+            argv[i] == std::string("-b")) {
+            benchmark_mode = true;
+        }
+    }
+    for (auto i = 1; i < argc; ++i) {
+        if (argv[i] == std::string("--benchmark") or
+            argv[i] == std::string("-b")) {
+            continue;
+        }
+        else if (benchmark_mode and
+                 (argv[i] == std::string("--show_test_names") or
+                  argv[i] == std::string("-n"))) {
+
+            TestSuite::get().print_benchmark_names(std::cout);
+            std::cout << std::flush;
+            throw ExitSuite();
+        }
+        else if (argv[i] == std::string("--show_test_names") or
             argv[i] == std::string("-n")) {
 
             TestSuite::get().print_test_names(std::cout);
@@ -557,13 +780,16 @@ std::vector<std::string> TestSuite::get_test_names_to_run(int argc,
         else if (argv[i] == std::string("--help") or
                  argv[i] == std::string("-h")) {
             std::cout << "usage: " << argv[0]
-                      << " [-h] [-n] [-q] [[TEST_NAME] ...]\n";
+                      << " [-h] [-n] [-q] [-b] [[TEST_NAME] ...]\n";
             std::cout
                 << "optional arguments:\n"
                 << " -h, --help\t\t show this help message and exit\n"
                 << " -n, --show_test_names\t print the names of all "
                    "discovered test cases and exit\n"
                 << " -q, --quiet\t\t print a reduced summary of test results\n"
+                << " -b, --benchmark\t run the benchmarks instead of the "
+                   "tests; -n and the names listed then refer to "
+                   "benchmarks\n"
                 << " TEST_NAME ...\t\t run only the test cases whose names "
                    "are "
                    "listed here. Note: If no test names are specified, all "
@@ -577,7 +803,15 @@ std::vector<std::string> TestSuite::get_test_names_to_run(int argc,
         }
     }
 
-    if (test_names_to_run.empty()) {
+    if (test_names_to_run.empty() and benchmark_mode) {
+        std::transform(
+            std::begin(benchmarks_), std::end(benchmarks_),
+            std::back_inserter(test_names_to_run),
+            [](const std::pair<std::string, BenchmarkCase>& p) {
+                return p.first;
+            });
+    }
+    else if (test_names_to_run.empty()) {
         std::transform(
             std::begin(tests_), std::end(tests_),
             std::back_inserter(test_names_to_run),